@@ -107,6 +107,9 @@ static void automount_done(Unit *u) {
         unmount_autofs(a);
         a->mount = NULL;
 
+        if (a->where)
+                mount_index_remove_unit(u, a->where);
+
         free(a->where);
         a->where = NULL;
 
@@ -137,14 +140,25 @@ int automount_add_one_mount_link(Automount *a, Mount *m) {
 }
 
 static int automount_add_mount_links(Automount *a) {
-        Meta *other;
+        const char *path;
+        MountNode *n;
+        Mount *m;
         int r;
 
         assert(a);
 
-        LIST_FOREACH(units_per_type, other, a->meta.manager->units_per_type[UNIT_MOUNT])
-                if ((r = automount_add_one_mount_link(a, (Mount*) other)) < 0)
-                        return r;
+        /* Only the mount points above ours are relevant, hence look
+         * them up in the mount index. Mounts loaded later find us
+         * there, too. */
+
+        if ((r = mount_index_add_unit(UNIT(a), a->where)) < 0)
+                return r;
+
+        path = a->where;
+        for (n = mount_node_root(a->meta.manager, path); n; n = mount_node_next(n, &path))
+                LIST_FOREACH(by_where, m, n->by_where)
+                        if ((r = automount_add_one_mount_link(a, m)) < 0)
+                                return r;
 
         return 0;
 }
@@ -831,6 +845,7 @@ DEFINE_STRING_TABLE_LOOKUP(automount_state, AutomountState);
 
 const UnitVTable automount_vtable = {
         .suffix = ".automount",
+        .object_size = sizeof(Automount),
 
         .no_alias = true,
         .no_instances = true,
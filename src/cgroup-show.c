@@ -108,23 +108,15 @@ static int show_cgroup_one_by_path(const char *path, const char *prefix, unsigne
         if (n > 0) {
                 unsigned i, m;
 
-                /* Filter duplicates */
-                m = 0;
-                for (i = 0; i < n; i++) {
-                        unsigned j;
-
-                        for (j = i+1; j < n; j++)
-                                if (pids[i] == pids[j])
-                                        break;
+                /* Sort, and then filter duplicates, which are now
+                 * next to each other */
+                qsort(pids, n, sizeof(pid_t), compare);
 
-                        if (j >= n)
+                for (i = 1, m = 1; i < n; i++)
+                        if (pids[i] != pids[m-1])
                                 pids[m++] = pids[i];
-                }
                 n = m;
 
-                /* And sort */
-                qsort(pids, n, sizeof(pid_t), compare);
-
                 if (n_columns > 8)
                         n_columns -= 8;
                 else
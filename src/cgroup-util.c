@@ -25,6 +25,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
@@ -34,50 +35,246 @@
 #include "macro.h"
 #include "util.h"
 
-int cg_enumerate_processes(const char *controller, const char *path, FILE **_f) {
-        char *fs;
+/* We cache the mount point of every hierarchy we have looked at. The
+ * manager additionally asks us to keep an fd to the root of each of
+ * them open, so that the helpers below can open files relative to it
+ * without resolving the full path each time. Everybody else, most
+ * importantly the PAM module which is loaded into long-running
+ * processes we don't control, opens files by path and keeps no fds
+ * around. */
+typedef struct CGroupMount {
+        char *controller;
+        char *mount_point;
+
+        /* The fd is only trusted as long as it still refers to the
+         * directory we opened */
+        int fd;
+        dev_t dev;
+        ino_t ino;
+} CGroupMount;
+
+static __thread CGroupMount *cg_mounts = NULL;
+static __thread unsigned n_cg_mounts = 0;
+static __thread pid_t cg_mounts_pid = 0;
+static __thread bool cg_mounts_keep_fds = false;
+
+static bool cg_mount_fd_valid(const CGroupMount *m) {
+        struct stat st;
+
+        assert(m);
+
+        if (m->fd < 0)
+                return false;
+
+        if (fstat(m->fd, &st) < 0)
+                return false;
+
+        return st.st_dev == m->dev && st.st_ino == m->ino;
+}
+
+static void cg_mounts_close_fds(void) {
+        unsigned i;
+
+        for (i = 0; i < n_cg_mounts; i++) {
+
+                /* If the number was closed and reused by somebody
+                 * else in the meantime it isn't ours to close */
+                if (cg_mount_fd_valid(cg_mounts + i))
+                        close_nointr_nofail(cg_mounts[i].fd);
+
+                cg_mounts[i].fd = -1;
+        }
+}
+
+void cg_set_keep_mount_fds(bool b) {
+
+        /* Only call this from the process owning the cgroup tree,
+         * i.e. the manager. Turning it off closes all fds. */
+
+        cg_mounts_keep_fds = b;
+
+        if (!b)
+                cg_mounts_close_fds();
+}
+
+static int cg_get_mount(const char *controller, const CGroupMount **_m) {
+        CGroupMount *m = NULL, *t;
+        const char *p;
+        char *mp, *c;
+        unsigned i;
+        pid_t pid;
         int r;
-        FILE *f;
 
         assert(controller);
-        assert(path);
-        assert(_f);
+        assert(_m);
+
+        /* We have been forked off since the fds were opened. The
+         * child shouldn't keep them around. */
+        pid = getpid();
+        if (pid != cg_mounts_pid) {
+                cg_mounts_close_fds();
+                cg_mounts_pid = pid;
+        }
 
-        if ((r = cg_get_path(controller, path, "cgroup.procs", &fs)) < 0)
-                return r;
+        for (i = 0; i < n_cg_mounts; i++)
+                if (streq(cg_mounts[i].controller, controller)) {
+                        m = cg_mounts + i;
+                        break;
+                }
 
-        f = fopen(fs, "re");
-        free(fs);
+        if (!m) {
+                /* This is a very minimal lookup from controller
+                 * names to paths. Since we have mounted most
+                 * hierarchies ourselves should be kinda safe, but
+                 * eventually we might want to extend this to have a
+                 * fallback to actually check /proc/mounts. */
+
+                if (streq(controller, SYSTEMD_CGROUP_CONTROLLER))
+                        p = "systemd";
+                else if (startswith(controller, "name="))
+                        p = controller + 5;
+                else
+                        p = controller;
 
-        if (!f)
-                return -errno;
+                if (asprintf(&mp, "/sys/fs/cgroup/%s", p) < 0)
+                        return -ENOMEM;
 
-        *_f = f;
+                path_kill_slashes(mp);
+
+                if ((r = path_is_mount_point(mp)) <= 0) {
+                        free(mp);
+                        return r < 0 ? r : -ENOENT;
+                }
+
+                if (!(c = strdup(controller))) {
+                        free(mp);
+                        return -ENOMEM;
+                }
+
+                if (!(t = realloc(cg_mounts, (n_cg_mounts + 1) * sizeof(CGroupMount)))) {
+                        free(mp);
+                        free(c);
+                        return -ENOMEM;
+                }
+
+                cg_mounts = t;
+                m = cg_mounts + n_cg_mounts++;
+                zero(*m);
+                m->controller = c;
+                m->mount_point = mp;
+                m->fd = -1;
+        }
+
+        if (cg_mounts_keep_fds) {
+                struct stat st;
+
+                /* Somebody closed our fd under our feet, don't use
+                 * whatever might have been opened under that number
+                 * since */
+                if (m->fd >= 0 && !cg_mount_fd_valid(m))
+                        m->fd = -1;
+
+                if (m->fd < 0) {
+                        if ((m->fd = open(m->mount_point, O_RDONLY|O_CLOEXEC|O_DIRECTORY|O_NOCTTY)) < 0)
+                                return -errno;
+
+                        if (fstat(m->fd, &st) < 0) {
+                                r = -errno;
+                                close_nointr_nofail(m->fd);
+                                m->fd = -1;
+                                return r;
+                        }
+
+                        m->dev = st.st_dev;
+                        m->ino = st.st_ino;
+                }
+        }
+
+        *_m = m;
         return 0;
 }
 
-int cg_enumerate_tasks(const char *controller, const char *path, FILE **_f) {
-        char *fs;
-        int r;
-        FILE *f;
+/* Opens a file or subgroup relative to the root of the hierarchy */
+static int cg_open_at(const char *controller, const char *path, const char *suffix, int flags) {
+        const CGroupMount *m;
+        char p[PATH_MAX];
+        int r, fd;
 
         assert(controller);
-        assert(path);
-        assert(_f);
 
-        if ((r = cg_get_path(controller, path, "tasks", &fs)) < 0)
+        if ((r = cg_get_mount(controller, &m)) < 0)
                 return r;
 
-        f = fopen(fs, "re");
-        free(fs);
+        if (path)
+                path += strspn(path, "/");
+
+        if (m->fd < 0) {
+                /* No cached fd, go by the full path */
+                if (path && *path && suffix)
+                        r = snprintf(p, sizeof(p), "%s/%s/%s", m->mount_point, path, suffix);
+                else if (path && *path)
+                        r = snprintf(p, sizeof(p), "%s/%s", m->mount_point, path);
+                else if (suffix)
+                        r = snprintf(p, sizeof(p), "%s/%s", m->mount_point, suffix);
+                else
+                        r = snprintf(p, sizeof(p), "%s", m->mount_point);
+        } else {
+                if (path && *path && suffix)
+                        r = snprintf(p, sizeof(p), "%s/%s", path, suffix);
+                else if (path && *path)
+                        r = snprintf(p, sizeof(p), "%s", path);
+                else if (suffix)
+                        r = snprintf(p, sizeof(p), "%s", suffix);
+                else
+                        r = snprintf(p, sizeof(p), ".");
+        }
+
+        if (r < 0 || (size_t) r >= sizeof(p))
+                return -ENAMETOOLONG;
+
+        if (m->fd < 0)
+                fd = open(p, flags|O_CLOEXEC|O_NOCTTY);
+        else
+                fd = openat(m->fd, p, flags|O_CLOEXEC|O_NOCTTY);
 
-        if (!f)
+        if (fd < 0)
                 return -errno;
 
+        return fd;
+}
+
+static int cg_fopen_at(const char *controller, const char *path, const char *suffix, FILE **_f) {
+        int fd;
+        FILE *f;
+
+        if ((fd = cg_open_at(controller, path, suffix, O_RDONLY)) < 0)
+                return fd;
+
+        if (!(f = fdopen(fd, "r"))) {
+                close_nointr_nofail(fd);
+                return -errno;
+        }
+
         *_f = f;
         return 0;
 }
 
+int cg_enumerate_processes(const char *controller, const char *path, FILE **_f) {
+        assert(controller);
+        assert(path);
+        assert(_f);
+
+        return cg_fopen_at(controller, path, "cgroup.procs", _f);
+}
+
+int cg_enumerate_tasks(const char *controller, const char *path, FILE **_f) {
+        assert(controller);
+        assert(path);
+        assert(_f);
+
+        return cg_fopen_at(controller, path, "tasks", _f);
+}
+
 int cg_read_pid(FILE *f, pid_t *_pid) {
         unsigned long ul;
 
@@ -101,8 +298,7 @@ int cg_read_pid(FILE *f, pid_t *_pid) {
 }
 
 int cg_enumerate_subgroups(const char *controller, const char *path, DIR **_d) {
-        char *fs;
-        int r;
+        int fd;
         DIR *d;
 
         assert(controller);
@@ -111,14 +307,13 @@ int cg_enumerate_subgroups(const char *controller, const char *path, DIR **_d) {
 
         /* This is not recursive! */
 
-        if ((r = cg_get_path(controller, path, NULL, &fs)) < 0)
-                return r;
-
-        d = opendir(fs);
-        free(fs);
+        if ((fd = cg_open_at(controller, path, NULL, O_RDONLY|O_DIRECTORY)) < 0)
+                return fd;
 
-        if (!d)
+        if (!(d = fdopendir(fd))) {
+                close_nointr_nofail(fd);
                 return -errno;
+        }
 
         *_d = d;
         return 0;
@@ -166,155 +361,436 @@ int cg_rmdir(const char *controller, const char *path) {
         return r < 0 ? -errno : 0;
 }
 
-int cg_kill(const char *controller, const char *path, int sig, bool sigcont, bool ignore_self, Set *s) {
-        bool done = false;
+/* A sorted, duplicate-free array of PIDs. The kill loop uses two of
+ * these: one for what it read in the current pass, and one for
+ * everything it already signalled. Both are kept sorted so that
+ * lookups are a bsearch() and folding in a pass is a linear merge. */
+typedef struct PidList {
+        pid_t *pids;
+        unsigned n, allocated;
+} PidList;
+
+static int pid_compare(const void *a, const void *b) {
+        const pid_t *x = a, *y = b;
+
+        return *x < *y ? -1 : (*x > *y ? 1 : 0);
+}
+
+static int pid_list_reserve(PidList *l, unsigned n) {
+        pid_t *p;
+        unsigned a;
+
+        assert(l);
+
+        if (n <= l->allocated)
+                return 0;
+
+        a = MAX(n, l->allocated * 2);
+        a = MAX(a, 64U);
+
+        if (!(p = realloc(l->pids, a * sizeof(pid_t))))
+                return -ENOMEM;
+
+        l->pids = p;
+        l->allocated = a;
+        return 0;
+}
+
+static bool pid_list_contains(const PidList *l, pid_t pid) {
+        assert(l);
+
+        return l->n > 0 && bsearch(&pid, l->pids, l->n, sizeof(pid_t), pid_compare);
+}
+
+/* Merges the sorted list b into the sorted list a, in place, back to
+ * front */
+static int pid_list_merge(PidList *a, const PidList *b) {
+        unsigned i, j, k;
+        int r;
+
+        assert(a);
+        assert(b);
+
+        if (b->n <= 0)
+                return 0;
+
+        if ((r = pid_list_reserve(a, a->n + b->n)) < 0)
+                return r;
+
+        i = a->n;
+        j = b->n;
+        k = a->n + b->n;
+
+        while (j > 0) {
+                if (i > 0 && a->pids[i-1] > b->pids[j-1])
+                        a->pids[--k] = a->pids[--i];
+                else
+                        a->pids[--k] = b->pids[--j];
+        }
+
+        a->n += b->n;
+        return 0;
+}
+
+/* Reads cgroup.procs of the group dfd refers to in one go, and
+ * returns the PIDs sorted and with duplicates removed */
+static int cg_read_pids_at(int dfd, PidList *l, char **buf, size_t *buf_size) {
+        size_t n = 0;
+        char *p, *e;
+        int fd, r = 0;
+
+        assert(dfd >= 0);
+        assert(l);
+        assert(buf);
+        assert(buf_size);
+
+        l->n = 0;
+
+        if ((fd = openat(dfd, "cgroup.procs", O_RDONLY|O_CLOEXEC|O_NOCTTY)) < 0)
+                return -errno;
+
+        for (;;) {
+                ssize_t k;
+
+                if (n + 1 >= *buf_size) {
+                        size_t a = MAX(*buf_size * 2, (size_t) 4096);
+
+                        if (!(p = realloc(*buf, a))) {
+                                r = -ENOMEM;
+                                goto finish;
+                        }
+
+                        *buf = p;
+                        *buf_size = a;
+                }
+
+                if ((k = read(fd, *buf + n, *buf_size - n - 1)) < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        r = -errno;
+                        goto finish;
+                }
+
+                if (k == 0)
+                        break;
+
+                n += k;
+        }
+
+        (*buf)[n] = 0;
+
+        for (p = *buf; *p; p = e) {
+                unsigned long ul;
+
+                p += strspn(p, WHITESPACE);
+                if (!*p)
+                        break;
+
+                errno = 0;
+                ul = strtoul(p, &e, 10);
+                if (errno != 0 || e == p || ul <= 0) {
+                        r = -EIO;
+                        goto finish;
+                }
+
+                if ((r = pid_list_reserve(l, l->n + 1)) < 0)
+                        goto finish;
+
+                l->pids[l->n++] = (pid_t) ul;
+        }
+
+        /* Note that the cgroup.procs might contain duplicates! See
+         * cgroups.txt for details. */
+        if (l->n > 1) {
+                unsigned i, j;
+
+                qsort(l->pids, l->n, sizeof(pid_t), pid_compare);
+
+                for (i = 1, j = 1; i < l->n; i++)
+                        if (l->pids[i] != l->pids[j-1])
+                                l->pids[j++] = l->pids[i];
+
+                l->n = j;
+        }
+
+finish:
+        close_nointr_nofail(fd);
+        return r;
+}
+
+typedef struct KillContext {
+        int sig;
+        bool sigcont;
+        pid_t ignore_pid;
+
+        /* Caller supplied PIDs to leave alone, and where to record
+         * what we killed, may be NULL */
+        Set *s;
+
+        PidList killed, current;
+        char *buf;
+        size_t buf_size;
+} KillContext;
+
+static void kill_context_done(KillContext *c) {
+        assert(c);
+
+        free(c->killed.pids);
+        free(c->current.pids);
+        free(c->buf);
+}
+
+static int cg_kill_at(KillContext *c, int dfd) {
         int r, ret = 0;
-        pid_t my_pid;
-        FILE *f = NULL;
-        Set *allocated_set = NULL;
 
-        assert(controller);
-        assert(path);
-        assert(sig >= 0);
+        assert(c);
+        assert(dfd >= 0);
 
         /* This goes through the tasks list and kills them all. This
          * is repeated until no further processes are added to the
          * tasks list, to properly handle forking processes */
 
-        if (!s)
-                if (!(s = allocated_set = set_new(trivial_hash_func, trivial_compare_func)))
-                        return -ENOMEM;
-
-        my_pid = getpid();
-
-        do {
-                pid_t pid = 0;
-                done = true;
+        for (;;) {
+                unsigned i, j;
 
-                if ((r = cg_enumerate_processes(controller, path, &f)) < 0) {
-                        if (ret >= 0 && r != -ENOENT)
+                if ((r = cg_read_pids_at(dfd, &c->current, &c->buf, &c->buf_size)) < 0) {
+                        if (ret >= 0 && r != -ENOENT && r != -ENODEV)
                                 ret = r;
 
-                        goto finish;
+                        return ret;
                 }
 
-                while ((r = cg_read_pid(f, &pid)) > 0) {
+                /* Drop everything we already took care of */
+                for (i = 0, j = 0; i < c->current.n; i++) {
+                        pid_t pid = c->current.pids[i];
 
-                        if (pid == my_pid && ignore_self)
+                        if (pid == c->ignore_pid)
                                 continue;
 
-                        if (set_get(s, LONG_TO_PTR(pid)) == LONG_TO_PTR(pid))
+                        if (pid_list_contains(&c->killed, pid))
                                 continue;
 
-                        /* If we haven't killed this process yet, kill
-                         * it */
-                        if (kill(pid, sig) < 0) {
+                        if (c->s && set_get(c->s, LONG_TO_PTR(pid)) == LONG_TO_PTR(pid))
+                                continue;
+
+                        c->current.pids[j++] = pid;
+                }
+
+                c->current.n = j;
+
+                /* To avoid racing against processes which fork
+                 * quicker than we can kill them we repeat this until
+                 * no new pids need to be killed. */
+                if (c->current.n <= 0)
+                        return ret;
+
+                for (i = 0; i < c->current.n; i++) {
+                        pid_t pid = c->current.pids[i];
+
+                        if (kill(pid, c->sig) < 0) {
                                 if (ret >= 0 && errno != ESRCH)
                                         ret = -errno;
-                        } else if (ret == 0) {
-
-                                if (sigcont)
+                        } else {
+                                if (c->sigcont)
                                         kill(pid, SIGCONT);
 
-                                ret = 1;
+                                if (ret == 0)
+                                        ret = 1;
                         }
 
-                        done = false;
-
-                        if ((r = set_put(s, LONG_TO_PTR(pid))) < 0) {
-                                if (ret >= 0)
-                                        ret = r;
+                        if (c->s)
+                                if ((r = set_put(c->s, LONG_TO_PTR(pid))) < 0) {
+                                        if (ret >= 0)
+                                                ret = r;
 
-                                goto finish;
-                        }
+                                        return ret;
+                                }
                 }
 
-                if (r < 0) {
+                if ((r = pid_list_merge(&c->killed, &c->current)) < 0) {
                         if (ret >= 0)
                                 ret = r;
 
-                        goto finish;
+                        return ret;
                 }
+        }
+}
 
-                fclose(f);
-                f = NULL;
+int cg_kill(const char *controller, const char *path, int sig, bool sigcont, bool ignore_self, Set *s) {
+        KillContext c;
+        int fd, r;
 
-                /* To avoid racing against processes which fork
-                 * quicker than we can kill them we repeat this until
-                 * no new pids need to be killed. */
+        assert(controller);
+        assert(path);
+        assert(sig >= 0);
 
-        } while (!done);
+        if ((fd = cg_open_at(controller, path, NULL, O_RDONLY|O_DIRECTORY)) < 0)
+                return fd == -ENOENT ? 0 : fd;
 
-finish:
-        if (allocated_set)
-                set_free(allocated_set);
+        zero(c);
+        c.sig = sig;
+        c.sigcont = sigcont;
+        c.ignore_pid = ignore_self ? getpid() : 0;
+        c.s = s;
 
-        if (f)
-                fclose(f);
+        r = cg_kill_at(&c, fd);
 
-        return ret;
+        kill_context_done(&c);
+        close_nointr_nofail(fd);
+
+        return r;
+}
+
+typedef struct KillFrame {
+        DIR *d;
+        char *name;
+} KillFrame;
+
+static int kill_frame_push(KillFrame **stack, unsigned *n, unsigned *allocated, int fd, const char *name) {
+        char *nm = NULL;
+        DIR *d;
+        int r;
+
+        assert(stack);
+        assert(n);
+        assert(allocated);
+        assert(fd >= 0);
+
+        /* Takes possession of fd, in all cases */
+
+        if (*n >= *allocated) {
+                unsigned a = MAX(*allocated * 2, 8U);
+                KillFrame *t;
+
+                if (!(t = realloc(*stack, a * sizeof(KillFrame)))) {
+                        r = -ENOMEM;
+                        goto fail;
+                }
+
+                *stack = t;
+                *allocated = a;
+        }
+
+        if (name && !(nm = strdup(name))) {
+                r = -ENOMEM;
+                goto fail;
+        }
+
+        if (!(d = fdopendir(fd))) {
+                r = -errno;
+                free(nm);
+                goto fail;
+        }
+
+        (*stack)[*n].d = d;
+        (*stack)[*n].name = nm;
+        (*n)++;
+
+        return 0;
+
+fail:
+        close_nointr_nofail(fd);
+        return r;
 }
 
 int cg_kill_recursive(const char *controller, const char *path, int sig, bool sigcont, bool ignore_self, bool rem, Set *s) {
-        int r, ret = 0;
-        DIR *d = NULL;
-        char *fn;
-        Set *allocated_set = NULL;
+        KillContext c;
+        KillFrame *stack = NULL;
+        unsigned n_stack = 0, n_allocated = 0;
+        int r, ret = 0, fd;
 
         assert(path);
         assert(controller);
         assert(sig >= 0);
 
-        if (!s)
-                if (!(s = allocated_set = set_new(trivial_hash_func, trivial_compare_func)))
-                        return -ENOMEM;
+        /* Walks the tree depth-first without recursion, with every
+         * subgroup opened relative to its parent, and kills every
+         * group before descending into it. If requested the groups
+         * are removed on the way back up, children first. */
 
-        ret = cg_kill(controller, path, sig, sigcont, ignore_self, s);
+        zero(c);
+        c.sig = sig;
+        c.sigcont = sigcont;
+        c.ignore_pid = ignore_self ? getpid() : 0;
+        c.s = s;
 
-        if ((r = cg_enumerate_subgroups(controller, path, &d)) < 0) {
-                if (ret >= 0 && r != -ENOENT)
+        if ((fd = cg_open_at(controller, path, NULL, O_RDONLY|O_DIRECTORY)) < 0) {
+                if (fd != -ENOENT)
+                        ret = fd;
+
+                goto finish;
+        }
+
+        ret = cg_kill_at(&c, fd);
+
+        if ((r = kill_frame_push(&stack, &n_stack, &n_allocated, fd, NULL)) < 0) {
+                if (ret >= 0)
                         ret = r;
 
                 goto finish;
         }
 
-        while ((r = cg_read_subgroup(d, &fn)) > 0) {
-                char *p = NULL;
+        while (n_stack > 0) {
+                KillFrame *top = stack + n_stack - 1;
+                struct dirent *de;
 
-                r = asprintf(&p, "%s/%s", path, fn);
-                free(fn);
+                errno = 0;
+                while ((de = readdir(top->d)))
+                        if (de->d_type == DT_DIR &&
+                            !streq(de->d_name, ".") &&
+                            !streq(de->d_name, ".."))
+                                break;
 
-                if (r < 0) {
-                        if (ret >= 0)
-                                ret = -ENOMEM;
+                if (!de) {
+                        if (errno != 0 && ret >= 0)
+                                ret = -errno;
 
-                        goto finish;
+                        /* Done with this group, go back up */
+                        closedir(top->d);
+                        n_stack--;
+
+                        if (rem) {
+                                if (n_stack > 0)
+                                        r = unlinkat(dirfd(stack[n_stack-1].d), top->name, AT_REMOVEDIR) < 0 ? -errno : 0;
+                                else
+                                        r = cg_rmdir(controller, path);
+
+                                if (r < 0 && ret >= 0 && r != -ENOENT && r != -EBUSY)
+                                        ret = r;
+                        }
+
+                        free(top->name);
+                        continue;
                 }
 
-                r = cg_kill_recursive(controller, p, sig, sigcont, ignore_self, rem, s);
-                free(p);
+                if ((fd = openat(dirfd(top->d), de->d_name, O_RDONLY|O_CLOEXEC|O_DIRECTORY|O_NOCTTY)) < 0) {
+                        if (errno != ENOENT && ret >= 0)
+                                ret = -errno;
 
-                if (r != 0 && ret >= 0)
-                        ret = r;
-        }
+                        continue;
+                }
 
-        if (r < 0 && ret >= 0)
-                ret = r;
+                if ((r = cg_kill_at(&c, fd)) != 0 && ret >= 0)
+                        ret = r;
 
-        if (rem)
-                if ((r = cg_rmdir(controller, path)) < 0) {
-                        if (ret >= 0 &&
-                            r != -ENOENT &&
-                            r != -EBUSY)
+                if ((r = kill_frame_push(&stack, &n_stack, &n_allocated, fd, de->d_name)) < 0) {
+                        if (ret >= 0)
                                 ret = r;
+
+                        goto finish;
                 }
+        }
 
 finish:
-        if (d)
-                closedir(d);
+        while (n_stack > 0) {
+                n_stack--;
+                closedir(stack[n_stack].d);
+                free(stack[n_stack].name);
+        }
 
-        if (allocated_set)
-                set_free(allocated_set);
+        free(stack);
+        kill_context_done(&c);
 
         return ret;
 }
@@ -481,55 +957,29 @@ finish:
 }
 
 int cg_get_path(const char *controller, const char *path, const char *suffix, char **fs) {
-        const char *p;
-        char *mp;
+        const CGroupMount *m;
         int r;
-        static __thread bool good = false;
 
         assert(controller);
         assert(fs);
 
-        /* This is a very minimal lookup from controller names to
-         * paths. Since we have mounted most hierarchies ourselves
-         * should be kinda safe, but eventually we might want to
-         * extend this to have a fallback to actually check
-         * /proc/mounts. Might need caching then. */
-
-        if (streq(controller, SYSTEMD_CGROUP_CONTROLLER))
-                p = "systemd";
-        else if (startswith(controller, "name="))
-                p = controller + 5;
-        else
-                p = controller;
-
-        if (asprintf(&mp, "/sys/fs/cgroup/%s", p) < 0)
-                return -ENOMEM;
-
-        if (!good) {
-                if ((r = path_is_mount_point(mp)) <= 0) {
-                        free(mp);
-                        return r < 0 ? r : -ENOENT;
-                }
-
-                /* Cache this to save a few stat()s */
-                good = true;
-        }
+        if ((r = cg_get_mount(controller, &m)) < 0)
+                return r;
 
         if (path && suffix)
-                r = asprintf(fs, "%s/%s/%s", mp, path, suffix);
+                r = asprintf(fs, "%s/%s/%s", m->mount_point, path, suffix);
         else if (path)
-                r = asprintf(fs, "%s/%s", mp, path);
+                r = asprintf(fs, "%s/%s", m->mount_point, path);
         else if (suffix)
-                r = asprintf(fs, "%s/%s", mp, suffix);
-        else {
-                path_kill_slashes(mp);
-                *fs = mp;
-                return 0;
-        }
+                r = asprintf(fs, "%s/%s", m->mount_point, suffix);
+        else
+                r = (*fs = strdup(m->mount_point)) ? 0 : -1;
+
+        if (r < 0)
+                return -ENOMEM;
 
-        free(mp);
         path_kill_slashes(*fs);
-        return r < 0 ? -ENOMEM : 0;
+        return 0;
 }
 
 int cg_trim(const char *controller, const char *path, bool delete_root) {
@@ -591,16 +1041,16 @@ int cg_create(const char *controller, const char *path) {
 }
 
 int cg_attach(const char *controller, const char *path, pid_t pid) {
-        char *fs;
-        int r;
+        int fd, r = 0;
         char c[32];
+        ssize_t k;
 
         assert(controller);
         assert(path);
         assert(pid >= 0);
 
-        if ((r = cg_get_path(controller, path, "tasks", &fs)) < 0)
-                return r;
+        if ((fd = cg_open_at(controller, path, "tasks", O_WRONLY)) < 0)
+                return fd;
 
         if (pid == 0)
                 pid = getpid();
@@ -608,8 +1058,12 @@ int cg_attach(const char *controller, const char *path, pid_t pid) {
         snprintf(c, sizeof(c), "%lu\n", (unsigned long) pid);
         char_array_0(c);
 
-        r = write_one_line_file(fs, c);
-        free(fs);
+        if ((k = write(fd, c, strlen(c))) < 0)
+                r = -errno;
+        else if ((size_t) k != strlen(c))
+                r = -EIO;
+
+        close_nointr_nofail(fd);
 
         return r;
 }
@@ -665,11 +1119,10 @@ int cg_set_task_access(const char *controller, const char *path, mode_t mode, ui
 }
 
 int cg_get_by_pid(const char *controller, pid_t pid, char **path) {
-        int r;
-        char *p = NULL;
-        FILE *f;
-        char *fs;
+        char fs[64];
+        char *contents = NULL, *l, *e;
         size_t cs;
+        int r;
 
         assert(controller);
         assert(path);
@@ -678,56 +1131,39 @@ int cg_get_by_pid(const char *controller, pid_t pid, char **path) {
         if (pid == 0)
                 pid = getpid();
 
-        if (asprintf(&fs, "/proc/%lu/cgroup", (unsigned long) pid) < 0)
-                return -ENOMEM;
+        snprintf(fs, sizeof(fs), "/proc/%lu/cgroup", (unsigned long) pid);
+        char_array_0(fs);
 
-        f = fopen(fs, "re");
-        free(fs);
-
-        if (!f)
-                return errno == ENOENT ? -ESRCH : -errno;
+        if ((r = read_full_file(fs, &contents)) < 0)
+                return r == -ENOENT ? -ESRCH : r;
 
         cs = strlen(controller);
 
-        while (!feof(f)) {
-                char line[LINE_MAX];
-                char *l;
-
-                errno = 0;
-                if (!(fgets(line, sizeof(line), f))) {
-                        if (feof(f))
-                                break;
-
-                        r = errno ? -errno : -EIO;
-                        goto finish;
-                }
-
-                truncate_nl(line);
+        /* Lines are of the form "<id>:<controller>:<path>" */
+        for (l = contents; *l; l = *e ? e + 1 : e) {
+                char *c;
 
-                if (!(l = strchr(line, ':')))
-                        continue;
+                e = l + strcspn(l, "\n");
 
-                l++;
-                if (strncmp(l, controller, cs) != 0)
+                if (!(c = memchr(l, ':', e - l)))
                         continue;
 
-                if (l[cs] != ':')
+                c++;
+                if ((size_t) (e - c) <= cs ||
+                    memcmp(c, controller, cs) != 0 ||
+                    c[cs] != ':')
                         continue;
 
-                if (!(p = strdup(l + cs + 1))) {
-                        r = -ENOMEM;
-                        goto finish;
-                }
+                c += cs + 1;
 
-                *path = p;
-                r = 0;
+                r = (*path = strndup(c, e - c)) ? 0 : -ENOMEM;
                 goto finish;
         }
 
         r = -ENOENT;
 
 finish:
-        fclose(f);
+        free(contents);
 
         return r;
 }
@@ -792,6 +1228,73 @@ finish:
         return r;
 }
 
+int cg_get_attribute_u64(const char *controller, const char *path, const char *attribute, uint64_t *ret) {
+        char buf[64];
+        ssize_t k;
+        int fd, r;
+
+        assert(controller);
+        assert(path);
+        assert(attribute);
+        assert(ret);
+
+        if ((fd = cg_open_at(controller, path, attribute, O_RDONLY)) < 0)
+                return fd;
+
+        k = read(fd, buf, sizeof(buf) - 1);
+        r = k < 0 ? -errno : 0;
+        close_nointr_nofail(fd);
+
+        if (r < 0)
+                return r;
+
+        buf[k] = 0;
+        return safe_atou64(strstrip(buf), ret);
+}
+
+int cg_count_tasks(const char *controller, const char *path, unsigned *ret) {
+        char buf[4096];
+        unsigned n = 0;
+        int fd, r = 0;
+
+        assert(controller);
+        assert(path);
+        assert(ret);
+
+        /* Every task is on a line of its own, so counting lines is
+         * enough, and we don't need to parse anything */
+
+        if ((fd = cg_open_at(controller, path, "tasks", O_RDONLY)) < 0)
+                return fd;
+
+        for (;;) {
+                ssize_t k;
+                char *p, *e;
+
+                if ((k = read(fd, buf, sizeof(buf))) < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        r = -errno;
+                        break;
+                }
+
+                if (k == 0)
+                        break;
+
+                for (p = buf, e = buf + k; (p = memchr(p, '\n', e - p)); p++)
+                        n++;
+        }
+
+        close_nointr_nofail(fd);
+
+        if (r < 0)
+                return r;
+
+        *ret = n;
+        return 0;
+}
+
 int cg_is_empty(const char *controller, const char *path, bool ignore_self) {
         pid_t pid = 0;
         int r;
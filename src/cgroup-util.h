@@ -64,9 +64,14 @@ int cg_set_task_access(const char *controller, const char *path, mode_t mode, ui
 
 int cg_install_release_agent(const char *controller, const char *agent);
 
+int cg_get_attribute_u64(const char *controller, const char *path, const char *attribute, uint64_t *ret);
+int cg_count_tasks(const char *controller, const char *path, unsigned *ret);
+
 int cg_is_empty(const char *controller, const char *path, bool ignore_self);
 int cg_is_empty_recursive(const char *controller, const char *path, bool ignore_self);
 
 int cg_get_user_path(char **path);
 
+void cg_set_keep_mount_fds(bool b);
+
 #endif
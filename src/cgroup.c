@@ -25,12 +25,198 @@
 #include <sys/types.h>
 #include <signal.h>
 #include <sys/mount.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <fcntl.h>
 
 #include "cgroup.h"
 #include "cgroup-util.h"
 #include "log.h"
 
+static CGroupNode *cgroup_node_child(CGroupNode *n, const char *name, size_t l) {
+        char buf[NAME_MAX+1];
+
+        assert(n);
+
+        if (!n->children || l > NAME_MAX)
+                return NULL;
+
+        memcpy(buf, name, l);
+        buf[l] = 0;
+
+        return hashmap_get(n->children, buf);
+}
+
+static void cgroup_node_prune(Manager *m, CGroupNode *n) {
+        assert(m);
+
+        /* Removes n and then its ancestors, as long as they are not
+         * needed anymore */
+
+        while (n && !n->bondings && hashmap_isempty(n->children)) {
+                CGroupNode *parent = n->parent;
+
+                if (parent)
+                        hashmap_remove(parent->children, n->name);
+                else {
+                        assert(m->cgroup_root == n);
+                        m->cgroup_root = NULL;
+                }
+
+                hashmap_free(n->children);
+                free(n->name);
+                free(n);
+
+                n = parent;
+        }
+}
+
+static CGroupNode *cgroup_node_get(Manager *m, const char *path) {
+        CGroupNode *n;
+        size_t l;
+
+        assert(m);
+        assert(path);
+
+        /* Like cgroup_node_find(), but creates missing nodes */
+
+        if (!m->cgroup_root) {
+                if (!(m->cgroup_root = new0(CGroupNode, 1)))
+                        return NULL;
+
+                if (!(m->cgroup_root->name = strdup(""))) {
+                        free(m->cgroup_root);
+                        m->cgroup_root = NULL;
+                        return NULL;
+                }
+        }
+
+        n = m->cgroup_root;
+
+        while ((l = path_next_component(&path)) > 0) {
+                CGroupNode *c;
+
+                if ((c = cgroup_node_child(n, path, l))) {
+                        n = c;
+                        path += l;
+                        continue;
+                }
+
+                if (l > NAME_MAX)
+                        goto fail;
+
+                if (!n->children)
+                        if (!(n->children = hashmap_new(string_hash_func, string_compare_func)))
+                                goto fail;
+
+                if (!(c = new0(CGroupNode, 1)))
+                        goto fail;
+
+                if (!(c->name = strndup(path, l))) {
+                        free(c);
+                        goto fail;
+                }
+
+                if (hashmap_put(n->children, c->name, c) < 0) {
+                        free(c->name);
+                        free(c);
+                        goto fail;
+                }
+
+                c->parent = n;
+                n = c;
+                path += l;
+        }
+
+        return n;
+
+fail:
+        cgroup_node_prune(m, n);
+        return NULL;
+}
+
+CGroupNode *cgroup_node_find(Manager *m, const char *path) {
+        CGroupNode *n;
+        size_t l;
+
+        assert(m);
+        assert(path);
+
+        if (!(n = m->cgroup_root))
+                return NULL;
+
+        while ((l = path_next_component(&path)) > 0) {
+                if (!(n = cgroup_node_child(n, path, l)))
+                        return NULL;
+
+                path += l;
+        }
+
+        return n;
+}
+
+CGroupNode *cgroup_node_find_closest(Manager *m, const char *path) {
+        CGroupNode *n, *best = NULL;
+        size_t l;
+
+        assert(m);
+        assert(path);
+
+        /* Returns the deepest node with bondings on the way to
+         * path, i.e. the group itself or its closest ancestor we
+         * know of */
+
+        if (!(n = m->cgroup_root))
+                return NULL;
+
+        for (;;) {
+                if (n->bondings)
+                        best = n;
+
+                if ((l = path_next_component(&path)) <= 0)
+                        break;
+
+                if (!(n = cgroup_node_child(n, path, l)))
+                        break;
+
+                path += l;
+        }
+
+        return best;
+}
+
+int cgroup_node_add_bonding(Manager *m, CGroupBonding *b) {
+        CGroupNode *n;
+
+        assert(m);
+        assert(b);
+        assert(b->path);
+        assert(!b->node);
+
+        if (!(n = cgroup_node_get(m, b->path)))
+                return -ENOMEM;
+
+        LIST_PREPEND(CGroupBonding, by_path, n->bondings, b);
+        b->node = n;
+
+        return 0;
+}
+
+void cgroup_node_remove_bonding(Manager *m, CGroupBonding *b) {
+        CGroupNode *n;
+
+        assert(m);
+        assert(b);
+
+        if (!(n = b->node))
+                return;
+
+        LIST_REMOVE(CGroupBonding, by_path, n->bondings, b);
+        b->node = NULL;
+
+        cgroup_node_prune(m, n);
+}
+
 int cgroup_bonding_realize(CGroupBonding *b) {
         int r;
 
@@ -67,19 +253,10 @@ void cgroup_bonding_free(CGroupBonding *b, bool remove_or_trim) {
         assert(b);
 
         if (b->unit) {
-                CGroupBonding *f;
-
                 LIST_REMOVE(CGroupBonding, by_unit, b->unit->meta.cgroup_bondings, b);
 
-                if (streq(b->controller, SYSTEMD_CGROUP_CONTROLLER)) {
-                        assert_se(f = hashmap_get(b->unit->meta.manager->cgroup_bondings, b->path));
-                        LIST_REMOVE(CGroupBonding, by_path, f, b);
-
-                        if (f)
-                                hashmap_replace(b->unit->meta.manager->cgroup_bondings, b->path, f);
-                        else
-                                hashmap_remove(b->unit->meta.manager->cgroup_bondings, b->path);
-                }
+                if (b->node)
+                        cgroup_node_remove_bonding(b->unit->meta.manager, b);
         }
 
         if (b->realized && b->ours && remove_or_trim) {
@@ -122,6 +299,17 @@ int cgroup_bonding_install(CGroupBonding *b, pid_t pid) {
         assert(b);
         assert(pid >= 0);
 
+        /* If the group was created beforehand, all we need to do
+         * is attach. It might have been trimmed away since, though,
+         * in which case we create it anew. */
+        if (b->realized) {
+                if ((r = cg_attach(b->controller, b->path, pid)) >= 0)
+                        return 0;
+
+                if (r != -ENOENT)
+                        return r;
+        }
+
         if ((r = cg_create_and_attach(b->controller, b->path, pid)) < 0)
                 return r;
 
@@ -231,6 +419,9 @@ int manager_setup_cgroup(Manager *m) {
                 return 0;
         }
 
+        /* We run the show, hence keep the hierarchies open */
+        cg_set_keep_mount_fds(true);
+
         /* 1. Determine hierarchy */
         if ((r = cg_get_by_pid(SYSTEMD_CGROUP_CONTROLLER, 0, &current)) < 0) {
                 log_error("Cannot determine cgroup we are running in: %s", strerror(-r));
@@ -312,20 +503,149 @@ void manager_shutdown_cgroup(Manager *m, bool delete) {
                 m->pin_cgroupfs_fd = -1;
         }
 
+        cg_set_keep_mount_fds(false);
+
+        if (m->accounting_watch.fd >= 0) {
+                close_nointr_nofail(m->accounting_watch.fd);
+                m->accounting_watch.fd = -1;
+        }
+
         free(m->cgroup_hierarchy);
         m->cgroup_hierarchy = NULL;
 }
 
+int manager_set_accounting_interval(Manager *m, usec_t interval) {
+        struct itimerspec its;
+
+        assert(m);
+
+        /* An interval of 0 turns sampling off */
+
+        if (m->accounting_watch.fd < 0) {
+                struct epoll_event ev;
+
+                if (interval <= 0) {
+                        m->accounting_interval = 0;
+                        return 0;
+                }
+
+                if ((m->accounting_watch.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC)) < 0)
+                        return -errno;
+
+                zero(ev);
+                ev.events = EPOLLIN;
+                ev.data.ptr = &m->accounting_watch;
+
+                if (epoll_ctl(m->epoll_fd, EPOLL_CTL_ADD, m->accounting_watch.fd, &ev) < 0) {
+                        close_nointr_nofail(m->accounting_watch.fd);
+                        m->accounting_watch.fd = -1;
+                        return -errno;
+                }
+
+                m->accounting_watch.type = WATCH_CGROUP_ACCOUNTING;
+        }
+
+        zero(its);
+        timespec_store(&its.it_value, interval);
+        its.it_interval = its.it_value;
+
+        if (timerfd_settime(m->accounting_watch.fd, 0, &its, NULL) < 0)
+                return -errno;
+
+        m->accounting_interval = interval;
+        return 0;
+}
+
+void cgroup_accounting_reset(CGroupAccounting *a) {
+        assert(a);
+
+        a->cpu_usage = (uint64_t) -1;
+        a->memory_usage = (uint64_t) -1;
+        a->n_tasks = (unsigned) -1;
+        a->timestamp = 0;
+}
+
+static void cgroup_bonding_sample(CGroupBonding *b, CGroupAccounting *a) {
+        uint64_t v;
+        unsigned n;
+
+        assert(b);
+        assert(a);
+
+        if (!b->realized)
+                return;
+
+        if (streq(b->controller, SYSTEMD_CGROUP_CONTROLLER)) {
+                if (cg_count_tasks(b->controller, b->path, &n) >= 0)
+                        a->n_tasks = n;
+
+        } else if (streq(b->controller, "cpuacct") ||
+                   streq(b->controller, "cpu")) {
+
+                /* cpu and cpuacct are usually mounted together,
+                 * in which case the cpu group tells us too */
+                if (cg_get_attribute_u64(b->controller, b->path, "cpuacct.usage", &v) >= 0)
+                        a->cpu_usage = v;
+
+        } else if (streq(b->controller, "memory")) {
+                if (cg_get_attribute_u64(b->controller, b->path, "memory.usage_in_bytes", &v) >= 0)
+                        a->memory_usage = v;
+        }
+}
+
+void cgroup_accounting_sample(Manager *m) {
+        UnitType t;
+        usec_t ts;
+
+        assert(m);
+
+        /* Takes one sample of all running units in a single pass, so
+         * that the bus and 'systemctl status' can show the values
+         * without touching the file system. Units that are not
+         * running have nothing worth sampling, hence we just forget
+         * what we read last for them. */
+
+        ts = now(CLOCK_MONOTONIC);
+
+        for (t = 0; t < _UNIT_TYPE_MAX; t++) {
+                Meta *meta;
+
+                LIST_FOREACH(units_per_type, meta, m->units_per_type[t]) {
+                        CGroupAccounting a;
+                        CGroupBonding *b;
+
+                        if (!meta->cgroup_bondings)
+                                continue;
+
+                        if (!UNIT_IS_ACTIVE_OR_ACTIVATING(unit_active_state((Unit*) meta))) {
+                                if (meta->cgroup_accounting.timestamp > 0)
+                                        cgroup_accounting_reset(&meta->cgroup_accounting);
+
+                                continue;
+                        }
+
+                        cgroup_accounting_reset(&a);
+
+                        LIST_FOREACH(by_unit, b, meta->cgroup_bondings)
+                                cgroup_bonding_sample(b, &a);
+
+                        a.timestamp = ts;
+                        meta->cgroup_accounting = a;
+                }
+        }
+}
+
 int cgroup_notify_empty(Manager *m, const char *group) {
-        CGroupBonding *l, *b;
+        CGroupNode *n;
+        CGroupBonding *b;
 
         assert(m);
         assert(group);
 
-        if (!(l = hashmap_get(m->cgroup_bondings, group)))
+        if (!(n = cgroup_node_find(m, group)))
                 return 0;
 
-        LIST_FOREACH(by_path, b, l) {
+        LIST_FOREACH(by_path, b, n->bondings) {
                 int t;
 
                 if (!b->unit)
@@ -349,7 +669,8 @@ int cgroup_notify_empty(Manager *m, const char *group) {
 }
 
 Unit* cgroup_unit_by_pid(Manager *m, pid_t pid) {
-        CGroupBonding *l, *b;
+        CGroupNode *n;
+        CGroupBonding *b;
         char *group = NULL;
 
         assert(m);
@@ -360,25 +681,13 @@ Unit* cgroup_unit_by_pid(Manager *m, pid_t pid) {
         if (cg_get_by_pid(SYSTEMD_CGROUP_CONTROLLER, pid, &group) < 0)
                 return NULL;
 
-        l = hashmap_get(m->cgroup_bondings, group);
-
-        if (!l) {
-                char *slash;
-
-                while ((slash = strrchr(group, '/'))) {
-                        if (slash == group)
-                                break;
-
-                        *slash = 0;
-
-                        if ((l = hashmap_get(m->cgroup_bondings, group)))
-                                break;
-                }
-        }
-
+        n = cgroup_node_find_closest(m, group);
         free(group);
 
-        LIST_FOREACH(by_path, b, l) {
+        if (!n)
+                return NULL;
+
+        LIST_FOREACH(by_path, b, n->bondings) {
 
                 if (!b->unit)
                         continue;
@@ -413,9 +722,9 @@ char *cgroup_bonding_to_string(CGroupBonding *b) {
         return r;
 }
 
-pid_t cgroup_bonding_search_main_pid(CGroupBonding *b) {
+static pid_t cgroup_bonding_search_main_pid_internal(CGroupBonding *b, pid_t mypid, Hashmap *parents) {
         FILE *f;
-        pid_t pid = 0, npid, mypid;
+        pid_t pid = 0, npid;
 
         assert(b);
 
@@ -425,16 +734,25 @@ pid_t cgroup_bonding_search_main_pid(CGroupBonding *b) {
         if (cg_enumerate_processes(b->controller, b->path, &f) < 0)
                 return 0;
 
-        mypid = getpid();
-
         while (cg_read_pid(f, &npid) > 0)  {
                 pid_t ppid;
+                void *v;
 
                 if (npid == pid)
                         continue;
 
-                /* Ignore processes that aren't our kids */
-                if (get_parent_of_pid(npid, &ppid) >= 0 && ppid != mypid)
+                /* Ignore processes that aren't our kids. The other
+                 * bondings of the unit usually list the same
+                 * processes, hence remember what we learnt. */
+                if (parents && (v = hashmap_get(parents, INT_TO_PTR(npid))))
+                        ppid = PTR_TO_INT(v);
+                else if (get_parent_of_pid(npid, &ppid) >= 0) {
+                        if (parents && ppid > 0)
+                                hashmap_put(parents, INT_TO_PTR(npid), INT_TO_PTR(ppid));
+                } else
+                        ppid = mypid;
+
+                if (ppid != mypid)
                         continue;
 
                 if (pid != 0) {
@@ -453,19 +771,36 @@ pid_t cgroup_bonding_search_main_pid(CGroupBonding *b) {
         return pid;
 }
 
+pid_t cgroup_bonding_search_main_pid(CGroupBonding *b) {
+        assert(b);
+
+        return cgroup_bonding_search_main_pid_internal(b, getpid(), NULL);
+}
+
 pid_t cgroup_bonding_search_main_pid_list(CGroupBonding *first) {
         CGroupBonding *b;
-        pid_t pid;
+        Hashmap *parents = NULL;
+        pid_t pid = 0, mypid;
 
         /* Try to find a main pid from this cgroup, but checking if
          * there's only one PID in the cgroup and returning it. Later
          * on we might want to add additional, smarter heuristics
          * here. */
 
+        if (!first)
+                return 0;
+
+        mypid = getpid();
+
+        /* If allocation fails we simply go without the cache */
+        if (first->by_unit_next)
+                parents = hashmap_new(trivial_hash_func, trivial_compare_func);
+
         LIST_FOREACH(by_unit, b, first)
-                if ((pid = cgroup_bonding_search_main_pid(b)) != 0)
-                        return pid;
+                if ((pid = cgroup_bonding_search_main_pid_internal(b, mypid, parents)) != 0)
+                        break;
 
-        return 0;
+        hashmap_free(parents);
 
+        return pid;
 }
@@ -23,6 +23,21 @@
 ***/
 
 typedef struct CGroupBonding CGroupBonding;
+typedef struct CGroupNode CGroupNode;
+typedef struct CGroupAccounting CGroupAccounting;
+
+#include <stdint.h>
+
+#include "util.h"
+
+/* The most recent resource usage sample of a unit's cgroups. Fields
+ * we could not determine are (uint64_t) -1 resp. (unsigned) -1. */
+struct CGroupAccounting {
+        uint64_t cpu_usage;    /* nsec, from cpuacct.usage */
+        uint64_t memory_usage; /* bytes, from memory.usage_in_bytes */
+        unsigned n_tasks;
+        usec_t timestamp;      /* CLOCK_MONOTONIC, 0 if never sampled */
+};
 
 #include "unit.h"
 
@@ -36,8 +51,9 @@ struct CGroupBonding {
         /* For the Unit::cgroup_bondings list */
         LIST_FIELDS(CGroupBonding, by_unit);
 
-        /* For the Manager::cgroup_bondings hashmap */
+        /* For the CGroupNode::bondings list */
         LIST_FIELDS(CGroupBonding, by_path);
+        CGroupNode *node;
 
         /* When shutting down, remove cgroup? Are our own tasks the
          * only ones in this group?*/
@@ -50,6 +66,25 @@ struct CGroupBonding {
         bool realized:1;
 };
 
+/* One path component in the name=systemd hierarchy. The nodes form a
+ * trie rooted in Manager::cgroup_root, and carry the bondings for
+ * exactly their path. Nodes without bondings and children are
+ * removed. */
+struct CGroupNode {
+        char *name;
+        CGroupNode *parent;
+
+        /* component name => CGroupNode, NULL if there are none */
+        Hashmap *children;
+
+        LIST_HEAD(CGroupBonding, bondings);
+};
+
+int cgroup_node_add_bonding(Manager *m, CGroupBonding *b);
+void cgroup_node_remove_bonding(Manager *m, CGroupBonding *b);
+CGroupNode *cgroup_node_find(Manager *m, const char *path);
+CGroupNode *cgroup_node_find_closest(Manager *m, const char *path);
+
 int cgroup_bonding_realize(CGroupBonding *b);
 int cgroup_bonding_realize_list(CGroupBonding *first);
 
@@ -80,6 +115,10 @@ pid_t cgroup_bonding_search_main_pid_list(CGroupBonding *b);
 int manager_setup_cgroup(Manager *m);
 void manager_shutdown_cgroup(Manager *m, bool delete);
 
+int manager_set_accounting_interval(Manager *m, usec_t interval);
+void cgroup_accounting_reset(CGroupAccounting *a);
+void cgroup_accounting_sample(Manager *m);
+
 int cgroup_notify_empty(Manager *m, const char *group);
 
 Unit* cgroup_unit_by_pid(Manager *m, pid_t pid);
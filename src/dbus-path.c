@@ -32,6 +32,9 @@
         "  <property name=\"Paths\" type=\"a(ss)\" access=\"read\"/>\n" \
         "  <property name=\"MakeDirectory\" type=\"b\" access=\"read\"/>\n" \
         "  <property name=\"DirectoryMode\" type=\"u\" access=\"read\"/>\n" \
+        "  <property name=\"TriggerHoldOffUSec\" type=\"t\" access=\"read\"/>\n" \
+        "  <property name=\"NEvents\" type=\"u\" access=\"read\"/>\n" \
+        "  <property name=\"NTriggers\" type=\"u\" access=\"read\"/>\n" \
         " </interface>\n"
 
 #define INTROSPECTION                                                   \
@@ -98,6 +101,9 @@ DBusHandlerResult bus_path_message_handler(Unit *u, DBusConnection *c, DBusMessa
                 { "org.freedesktop.systemd1.Path", "Paths",         bus_path_append_paths,    "a(ss)", u                        },
                 { "org.freedesktop.systemd1.Path", "MakeDirectory", bus_property_append_bool, "b",     &u->path.make_directory  },
                 { "org.freedesktop.systemd1.Path", "DirectoryMode", bus_property_append_mode, "u",     &u->path.directory_mode  },
+                { "org.freedesktop.systemd1.Path", "TriggerHoldOffUSec", bus_property_append_usec, "t", &u->path.trigger_holdoff_usec },
+                { "org.freedesktop.systemd1.Path", "NEvents",       bus_property_append_unsigned, "u", &u->path.n_events        },
+                { "org.freedesktop.systemd1.Path", "NTriggers",     bus_property_append_unsigned, "u", &u->path.n_triggers      },
                 { NULL, NULL, NULL, NULL, NULL }
         };
 
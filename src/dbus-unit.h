@@ -108,6 +108,9 @@
         "  <property name=\"IgnoreOnSnapshot\" type=\"b\" access=\"read\"/>\n" \
         "  <property name=\"DefaultControlGroup\" type=\"s\" access=\"read\"/>\n" \
         "  <property name=\"ControlGroup\" type=\"as\" access=\"read\"/>\n" \
+        "  <property name=\"ControlGroupCPUUsageNSec\" type=\"t\" access=\"read\"/>\n" \
+        "  <property name=\"ControlGroupMemoryUsage\" type=\"t\" access=\"read\"/>\n" \
+        "  <property name=\"ControlGroupTasks\" type=\"u\" access=\"read\"/>\n" \
         "  <property name=\"NeedDaemonReload\" type=\"b\" access=\"read\"/>\n" \
         "  <property name=\"JobTimeoutUSec\" type=\"t\" access=\"read\"/>\n" \
         "  <property name=\"ConditionTimestamp\" type=\"t\" access=\"read\"/>\n" \
@@ -166,6 +169,9 @@
         { "org.freedesktop.systemd1.Unit", "IgnoreOnSnapshot",     bus_property_append_bool,       "b",    &u->meta.ignore_on_snapshot       }, \
         { "org.freedesktop.systemd1.Unit", "DefaultControlGroup",  bus_unit_append_default_cgroup, "s",    u                                 }, \
         { "org.freedesktop.systemd1.Unit", "ControlGroup",         bus_unit_append_cgroups,        "as",   u                                 }, \
+        { "org.freedesktop.systemd1.Unit", "ControlGroupCPUUsageNSec", bus_property_append_uint64,  "t",    &u->meta.cgroup_accounting.cpu_usage }, \
+        { "org.freedesktop.systemd1.Unit", "ControlGroupMemoryUsage", bus_property_append_uint64,   "t",    &u->meta.cgroup_accounting.memory_usage }, \
+        { "org.freedesktop.systemd1.Unit", "ControlGroupTasks",    bus_property_append_uint32,     "u",    &u->meta.cgroup_accounting.n_tasks }, \
         { "org.freedesktop.systemd1.Unit", "NeedDaemonReload",     bus_unit_append_need_daemon_reload, "b", u                                }, \
         { "org.freedesktop.systemd1.Unit", "JobTimeoutUSec",       bus_property_append_usec,       "t",    &u->meta.job_timeout              }, \
         { "org.freedesktop.systemd1.Unit", "ConditionTimestamp",   bus_property_append_usec,       "t",    &u->meta.condition_timestamp.realtime }, \
@@ -29,6 +29,8 @@
 
 #define DEFAULT_EXIT_USEC (5*USEC_PER_MINUTE)
 
+#define DEFAULT_ACCOUNTING_INTERVAL_USEC 0
+
 #define SYSTEMD_CGROUP_CONTROLLER "name=systemd"
 
 #define SIGNALS_CRASH_HANDLER SIGSEGV,SIGILL,SIGFPE,SIGBUS,SIGQUIT,SIGABRT
@@ -31,28 +31,146 @@
 #include "dbus-device.h"
 #include "def.h"
 
+/* Upper limit of uevents we read in one go */
+#define DEVICE_EVENT_BATCH_MAX 256
+
+/* The udev properties of a device we care about. They are looked up
+ * once and shared by all units of the device. */
+typedef struct DeviceInfo {
+        const char *sysfs;
+        const char *model;
+        const char *alias;
+        const char *wants;
+} DeviceInfo;
+
+/* The pending uevents of one device, read in the same batch */
+typedef struct DeviceEvent {
+        struct udev_device *dev; /* the most recent event */
+        bool removed:1;          /* an earlier event removed the device */
+        bool plugged:1;
+} DeviceEvent;
+
 static const UnitActiveState state_translation_table[_DEVICE_STATE_MAX] = {
         [DEVICE_DEAD] = UNIT_INACTIVE,
         [DEVICE_PLUGGED] = UNIT_ACTIVE
 };
 
+static void device_group_update_master(DeviceGroup *g) {
+        unsigned i;
+
+        assert(g);
+        assert(g->n_units > 0);
+
+        /* Make everybody follow the unit that's named after the sysfs
+         * path, or if there is none, the one added last */
+
+        for (i = 0; i < g->n_units; i++)
+                if (startswith(g->units[i]->meta.id, "sys-")) {
+                        g->master = g->units[i];
+                        return;
+                }
+
+        g->master = g->units[g->n_units-1];
+}
+
+static void device_group_free(Manager *m, DeviceGroup *g) {
+        assert(m);
+        assert(g);
+        assert(g->n_units == 0);
+
+        hashmap_remove(m->devices_by_sysfs, g->sysfs);
+
+        free(g->units);
+        free(g->sysfs);
+        free(g);
+}
+
+static int device_set_sysfs(Device *d, const char *sysfs) {
+        Manager *m;
+        DeviceGroup *g;
+        Unit **a;
+        int r;
+
+        assert(d);
+        assert(sysfs);
+        assert(!d->sysfs);
+
+        /* Add this unit to the group of devices which share the same
+         * sysfs path. */
+
+        m = d->meta.manager;
+
+        if (!m->devices_by_sysfs)
+                if (!(m->devices_by_sysfs = hashmap_new(string_hash_func, string_compare_func)))
+                        return -ENOMEM;
+
+        if (!(g = hashmap_get(m->devices_by_sysfs, sysfs))) {
+
+                if (!(g = new0(DeviceGroup, 1)))
+                        return -ENOMEM;
+
+                if (!(g->sysfs = strdup(sysfs))) {
+                        free(g);
+                        return -ENOMEM;
+                }
+
+                if ((r = hashmap_put(m->devices_by_sysfs, g->sysfs, g)) < 0) {
+                        free(g->sysfs);
+                        free(g);
+                        return r;
+                }
+        }
+
+        if (!(d->sysfs = strdup(sysfs)))
+                goto fail;
+
+        if (!(a = realloc(g->units, sizeof(Unit*) * (g->n_units + 1))))
+                goto fail;
+
+        g->units = a;
+        g->units[g->n_units++] = UNIT(d);
+        d->group = g;
+
+        device_group_update_master(g);
+        return 0;
+
+fail:
+        free(d->sysfs);
+        d->sysfs = NULL;
+
+        if (g->n_units == 0)
+                device_group_free(m, g);
+
+        return -ENOMEM;
+}
+
 static void device_unset_sysfs(Device *d) {
-        Device *first;
+        DeviceGroup *g;
+        unsigned i;
 
         assert(d);
 
         if (!d->sysfs)
                 return;
 
-        /* Remove this unit from the chain of devices which share the
+        /* Remove this unit from the group of devices which share the
          * same sysfs path. */
-        first = hashmap_get(d->meta.manager->devices_by_sysfs, d->sysfs);
-        LIST_REMOVE(Device, same_sysfs, first, d);
 
-        if (first)
-                hashmap_remove_and_replace(d->meta.manager->devices_by_sysfs, d->sysfs, first->sysfs, first);
+        g = d->group;
+        assert(g);
+
+        for (i = 0; g->units[i] != UNIT(d); i++)
+                assert(i < g->n_units);
+
+        memmove(g->units + i, g->units + i + 1, sizeof(Unit*) * (g->n_units - i - 1));
+        g->n_units--;
+
+        if (g->n_units > 0)
+                device_group_update_master(g);
         else
-                hashmap_remove(d->meta.manager->devices_by_sysfs, d->sysfs);
+                device_group_free(d->meta.manager, g);
+
+        d->group = NULL;
 
         free(d->sysfs);
         d->sysfs = NULL;
@@ -155,120 +273,104 @@ static int device_add_escaped_name(Unit *u, const char *dn) {
         return 0;
 }
 
-static int device_find_escape_name(Manager *m, const char *dn, Unit **_u) {
-        char *e;
-        Unit *u;
-
-        assert(m);
-        assert(dn);
-        assert(dn[0] == '/');
-        assert(_u);
+static void device_info_init(DeviceInfo *info, struct udev_device *dev) {
+        assert(info);
+        assert(dev);
 
-        if (!(e = unit_name_from_path(dn, ".device")))
-                return -ENOMEM;
+        zero(*info);
 
-        u = manager_get_unit(m, e);
-        free(e);
+        info->sysfs = udev_device_get_syspath(dev);
 
-        if (u) {
-                *_u = u;
-                return 1;
-        }
+        if (!(info->model = udev_device_get_property_value(dev, "ID_MODEL_FROM_DATABASE")))
+                info->model = udev_device_get_property_value(dev, "ID_MODEL");
 
-        return 0;
+        info->alias = udev_device_get_property_value(dev, "SYSTEMD_ALIAS");
+        info->wants = udev_device_get_property_value(dev, "SYSTEMD_WANTS");
 }
 
-static int device_update_unit(Manager *m, struct udev_device *dev, const char *path, bool main) {
-        const char *sysfs, *model;
-        Unit *u = NULL;
+static int device_update_unit(Manager *m, const DeviceInfo *info, const char *path, bool main) {
+        const char *description;
+        char *e;
+        Unit *u;
         int r;
         bool delete;
 
         assert(m);
+        assert(info);
+        assert(info->sysfs);
+        assert(path);
+        assert(path[0] == '/');
 
-        if (!(sysfs = udev_device_get_syspath(dev)))
+        if (!(e = unit_name_from_path(path, ".device")))
                 return -ENOMEM;
 
-        if ((r = device_find_escape_name(m, path, &u)) < 0)
-                return r;
+        u = manager_get_unit(m, e);
 
-        if (u && DEVICE(u)->sysfs && !path_equal(DEVICE(u)->sysfs, sysfs))
+        if (u && DEVICE(u)->sysfs && !path_equal(DEVICE(u)->sysfs, info->sysfs)) {
+                free(e);
                 return -EEXIST;
+        }
 
         if (!u) {
                 delete = true;
 
-                if (!(u = unit_new(m)))
+                if (!(u = unit_new(m, sizeof(Device)))) {
+                        free(e);
                         return -ENOMEM;
+                }
+
+                r = unit_add_name(u, e);
+                free(e);
 
-                if ((r = device_add_escaped_name(u, path)) < 0)
+                if (r < 0)
                         goto fail;
 
                 unit_add_to_load_queue(u);
-        } else
+        } else {
                 delete = false;
+                free(e);
+        }
 
         /* If this was created via some dependency and has not
          * actually been seen yet ->sysfs will not be
          * initialized. Hence initialize it if necessary. */
 
-        if (!DEVICE(u)->sysfs) {
-                Device *first;
-
-                if (!(DEVICE(u)->sysfs = strdup(sysfs))) {
-                        r = -ENOMEM;
+        if (!DEVICE(u)->sysfs)
+                if ((r = device_set_sysfs(DEVICE(u), info->sysfs)) < 0)
                         goto fail;
-                }
-
-                if (!m->devices_by_sysfs)
-                        if (!(m->devices_by_sysfs = hashmap_new(string_hash_func, string_compare_func))) {
-                                r = -ENOMEM;
-                                goto fail;
-                        }
-
-                first = hashmap_get(m->devices_by_sysfs, sysfs);
-                LIST_PREPEND(Device, same_sysfs, first, DEVICE(u));
 
-                if ((r = hashmap_replace(m->devices_by_sysfs, DEVICE(u)->sysfs, first)) < 0)
-                        goto fail;
-        }
-
-        if ((model = udev_device_get_property_value(dev, "ID_MODEL_FROM_DATABASE")) ||
-            (model = udev_device_get_property_value(dev, "ID_MODEL"))) {
-                if ((r = unit_set_description(u, model)) < 0)
-                        goto fail;
-        } else
-                if ((r = unit_set_description(u, path)) < 0)
+        description = info->model ? info->model : path;
+        if (!streq_ptr(u->meta.description, description))
+                if ((r = unit_set_description(u, description)) < 0)
                         goto fail;
 
         if (main) {
                 /* The additional systemd udev properties we only
                  * interpret for the main object */
-                const char *wants, *alias;
 
-                if ((alias = udev_device_get_property_value(dev, "SYSTEMD_ALIAS"))) {
-                        if (!is_path(alias))
-                                log_warning("SYSTEMD_ALIAS for %s is not a path, ignoring: %s", sysfs, alias);
+                if (info->alias) {
+                        if (!is_path(info->alias))
+                                log_warning("SYSTEMD_ALIAS for %s is not a path, ignoring: %s", info->sysfs, info->alias);
                         else {
-                                if ((r = device_add_escaped_name(u, alias)) < 0)
+                                if ((r = device_add_escaped_name(u, info->alias)) < 0)
                                         goto fail;
                         }
                 }
 
-                if ((wants = udev_device_get_property_value(dev, "SYSTEMD_WANTS"))) {
+                if (info->wants) {
                         char *state, *w;
                         size_t l;
 
-                        FOREACH_WORD_QUOTED(w, l, wants, state) {
-                                char *e;
+                        FOREACH_WORD_QUOTED(w, l, info->wants, state) {
+                                char *n;
 
-                                if (!(e = strndup(w, l))) {
+                                if (!(n = strndup(w, l))) {
                                         r = -ENOMEM;
                                         goto fail;
                                 }
 
-                                r = unit_add_dependency_by_name(u, UNIT_WANTS, e, NULL, true);
-                                free(e);
+                                r = unit_add_dependency_by_name(u, UNIT_WANTS, n, NULL, true);
+                                free(n);
 
                                 if (r < 0)
                                         goto fail;
@@ -288,21 +390,26 @@ fail:
         return r;
 }
 
-static int device_process_new_device(Manager *m, struct udev_device *dev, bool update_state) {
-        const char *sysfs, *dn;
+static int device_process_new_device(Manager *m, struct udev_device *dev) {
+        const char *dn;
         struct udev_list_entry *item = NULL, *first = NULL;
+        DeviceInfo info;
 
         assert(m);
 
-        if (!(sysfs = udev_device_get_syspath(dev)))
+        /* Look up the properties we need only once, and not again
+         * for each unit of this device */
+        device_info_init(&info, dev);
+
+        if (!info.sysfs)
                 return -ENOMEM;
 
         /* Add the main unit named after the sysfs path */
-        device_update_unit(m, dev, sysfs, true);
+        device_update_unit(m, &info, info.sysfs, true);
 
         /* Add an additional unit for the device node */
         if ((dn = udev_device_get_devnode(dev)))
-                device_update_unit(m, dev, dn, false);
+                device_update_unit(m, &info, dn, false);
 
         /* Add additional units for all symlinks */
         first = udev_device_get_devlinks_list_entry(dev);
@@ -329,23 +436,13 @@ static int device_process_new_device(Manager *m, struct udev_device *dev, bool u
                             st.st_rdev != udev_device_get_devnum(dev))
                                 continue;
 
-                device_update_unit(m, dev, p, false);
-        }
-
-        if (update_state) {
-                Device *d, *l;
-
-                manager_dispatch_load_queue(m);
-
-                l = hashmap_get(m->devices_by_sysfs, sysfs);
-                LIST_FOREACH(same_sysfs, d, l)
-                        device_set_state(d, DEVICE_PLUGGED);
+                device_update_unit(m, &info, p, false);
         }
 
         return 0;
 }
 
-static int device_process_path(Manager *m, const char *path, bool update_state) {
+static int device_process_path(Manager *m, const char *path) {
         int r;
         struct udev_device *dev;
 
@@ -357,14 +454,14 @@ static int device_process_path(Manager *m, const char *path, bool update_state)
                 return -ENOMEM;
         }
 
-        r = device_process_new_device(m, dev, update_state);
+        r = device_process_new_device(m, dev);
         udev_device_unref(dev);
         return r;
 }
 
 static int device_process_removed_device(Manager *m, struct udev_device *dev) {
         const char *sysfs;
-        Device *d;
+        DeviceGroup *g;
 
         assert(m);
         assert(dev);
@@ -373,7 +470,9 @@ static int device_process_removed_device(Manager *m, struct udev_device *dev) {
                 return -ENOMEM;
 
         /* Remove all units of this sysfs path */
-        while ((d = hashmap_get(m->devices_by_sysfs, sysfs))) {
+        while ((g = hashmap_get(m->devices_by_sysfs, sysfs))) {
+                Device *d = DEVICE(g->units[0]);
+
                 device_unset_sysfs(d);
                 device_set_state(d, DEVICE_DEAD);
         }
@@ -383,59 +482,31 @@ static int device_process_removed_device(Manager *m, struct udev_device *dev) {
 
 static Unit *device_following(Unit *u) {
         Device *d = DEVICE(u);
-        Device *other, *first = NULL;
 
         assert(d);
 
-        if (startswith(u->meta.id, "sys-"))
+        if (!d->group || d->group->master == u)
                 return NULL;
 
-        /* Make everybody follow the unit that's named after the sysfs path */
-        for (other = d->same_sysfs_next; other; other = other->same_sysfs_next)
-                if (startswith(other->meta.id, "sys-"))
-                        return UNIT(other);
-
-        for (other = d->same_sysfs_prev; other; other = other->same_sysfs_prev) {
-                if (startswith(other->meta.id, "sys-"))
-                        return UNIT(other);
-
-                first = other;
-        }
-
-        return UNIT(first);
+        return d->group->master;
 }
 
-static int device_following_set(Unit *u, Set **_s) {
+static int device_following_set(Unit *u, Unit ***units, unsigned *n) {
         Device *d = DEVICE(u);
-        Device *other;
-        Set *s;
-        int r;
 
         assert(d);
-        assert(_s);
+        assert(units);
+        assert(n);
 
-        if (!d->same_sysfs_prev && !d->same_sysfs_next) {
-                *_s = NULL;
+        if (!d->group || d->group->n_units <= 1) {
+                *units = NULL;
+                *n = 0;
                 return 0;
         }
 
-        if (!(s = set_new(NULL, NULL)))
-                return -ENOMEM;
-
-        for (other = d->same_sysfs_next; other; other = other->same_sysfs_next)
-                if ((r = set_put(s, other)) < 0)
-                        goto fail;
-
-        for (other = d->same_sysfs_prev; other; other = other->same_sysfs_prev)
-                if ((r = set_put(s, other)) < 0)
-                        goto fail;
-
-        *_s = s;
+        *units = d->group->units;
+        *n = d->group->n_units;
         return 1;
-
-fail:
-        set_free(s);
-        return r;
 }
 
 static void device_shutdown(Manager *m) {
@@ -490,6 +561,11 @@ static int device_enumerate(Manager *m) {
                 m->udev_watch.type = WATCH_UDEV;
                 m->udev_watch.fd = udev_monitor_get_fd(m->udev_monitor);
 
+                /* We drain the monitor until it runs dry, see
+                 * device_fd_event() */
+                if ((r = fd_nonblock(m->udev_watch.fd, true)) < 0)
+                        goto fail;
+
                 zero(ev);
                 ev.events = EPOLLIN;
                 ev.data.ptr = &m->udev_watch;
@@ -514,7 +590,7 @@ static int device_enumerate(Manager *m) {
 
         first = udev_enumerate_get_list_entry(e);
         udev_list_entry_foreach(item, first)
-                device_process_path(m, udev_list_entry_get_name(item), false);
+                device_process_path(m, udev_list_entry_get_name(item));
 
         udev_enumerate_unref(e);
         return 0;
@@ -527,10 +603,49 @@ fail:
         return r;
 }
 
-void device_fd_event(Manager *m, int events) {
-        struct udev_device *dev;
+static bool device_event_is_remove(struct udev_device *dev) {
+        const char *ready;
+
+        assert(dev);
+
+        if (streq(udev_device_get_action(dev), "remove"))
+                return true;
+
+        ready = udev_device_get_property_value(dev, "SYSTEMD_READY");
+
+        return ready && parse_boolean(ready) == 0;
+}
+
+static void device_event_free(DeviceEvent *e) {
+        assert(e);
+
+        udev_device_unref(e->dev);
+        free(e);
+}
+
+static void device_process_event(Manager *m, DeviceEvent *e) {
         int r;
-        const char *action, *ready;
+
+        assert(m);
+        assert(e);
+
+        if (e->removed || device_event_is_remove(e->dev))
+                if ((r = device_process_removed_device(m, e->dev)) < 0)
+                        log_error("Failed to process udev device event: %s", strerror(-r));
+
+        if (!device_event_is_remove(e->dev)) {
+                if ((r = device_process_new_device(m, e->dev)) < 0)
+                        log_error("Failed to process udev device event: %s", strerror(-r));
+                else
+                        e->plugged = true;
+        }
+}
+
+void device_fd_event(Manager *m, int events) {
+        Hashmap *batch;
+        DeviceEvent *e;
+        Iterator i;
+        unsigned n;
 
         assert(m);
 
@@ -543,35 +658,87 @@ void device_fd_event(Manager *m, int events) {
                         return;
         }
 
-        if (!(dev = udev_monitor_receive_device(m->udev_monitor))) {
-                /*
-                 * libudev might filter-out devices which pass the bloom filter,
-                 * so getting NULL here is not necessarily an error
-                 */
+        if (!(batch = hashmap_new(string_hash_func, string_compare_func))) {
+                log_error("Failed to allocate udev event batch.");
                 return;
         }
 
-        if (!(action = udev_device_get_action(dev))) {
-                log_error("Failed to get udev action string.");
-                goto fail;
-        }
+        /* Read everything that is queued, but remember only the most
+         * recent event of each device, so that a storm of change
+         * events is applied only once. We stop after a while to give
+         * the other event sources a chance; epoll will wake us up
+         * again for the rest. */
+        for (n = 0; n < DEVICE_EVENT_BATCH_MAX; n++) {
+                struct udev_device *dev;
+                const char *sysfs;
+
+                /* libudev might filter-out devices which pass the
+                 * bloom filter, so getting NULL here is not
+                 * necessarily an error, nor the end of the queue. But
+                 * if it isn't, epoll will tell us. */
+                if (!(dev = udev_monitor_receive_device(m->udev_monitor)))
+                        break;
+
+                if (!udev_device_get_action(dev)) {
+                        log_error("Failed to get udev action string.");
+                        udev_device_unref(dev);
+                        continue;
+                }
 
-        ready = udev_device_get_property_value(dev, "SYSTEMD_READY");
+                if (!(sysfs = udev_device_get_syspath(dev))) {
+                        udev_device_unref(dev);
+                        continue;
+                }
 
-        if (streq(action, "remove") || (ready && parse_boolean(ready) == 0)) {
-                if ((r = device_process_removed_device(m, dev)) < 0) {
-                        log_error("Failed to process udev device event: %s", strerror(-r));
-                        goto fail;
+                if ((e = hashmap_get(batch, sysfs))) {
+                        /* The key points into the event we replace */
+                        hashmap_replace(batch, sysfs, e);
+
+                        if (device_event_is_remove(e->dev))
+                                e->removed = true;
+
+                        udev_device_unref(e->dev);
+                        e->dev = dev;
+                        continue;
                 }
-        } else {
-                if ((r = device_process_new_device(m, dev, true)) < 0) {
-                        log_error("Failed to process udev device event: %s", strerror(-r));
-                        goto fail;
+
+                if (!(e = new0(DeviceEvent, 1))) {
+                        log_error("Failed to allocate udev event.");
+                        udev_device_unref(dev);
+                        break;
+                }
+
+                e->dev = dev;
+
+                if (hashmap_put(batch, sysfs, e) < 0) {
+                        log_error("Failed to queue udev event.");
+                        device_event_free(e);
+                        break;
                 }
         }
 
-fail:
-        udev_device_unref(dev);
+        HASHMAP_FOREACH(e, batch, i)
+                device_process_event(m, e);
+
+        /* Now that the units of all devices are loaded, update their
+         * state in one go */
+        manager_dispatch_load_queue(m);
+
+        while ((e = hashmap_steal_first(batch))) {
+
+                if (e->plugged) {
+                        DeviceGroup *g;
+                        unsigned k;
+
+                        if ((g = hashmap_get(m->devices_by_sysfs, udev_device_get_syspath(e->dev))))
+                                for (k = 0; k < g->n_units; k++)
+                                        device_set_state(DEVICE(g->units[k]), DEVICE_PLUGGED);
+                }
+
+                device_event_free(e);
+        }
+
+        hashmap_free(batch);
 }
 
 static const char* const device_state_table[_DEVICE_STATE_MAX] = {
@@ -583,6 +750,7 @@ DEFINE_STRING_TABLE_LOOKUP(device_state, DeviceState);
 
 const UnitVTable device_vtable = {
         .suffix = ".device",
+        .object_size = sizeof(Device),
 
         .no_instances = true,
 
@@ -23,6 +23,7 @@
 ***/
 
 typedef struct Device Device;
+typedef struct DeviceGroup DeviceGroup;
 
 #include "unit.h"
 
@@ -42,13 +43,25 @@ struct Device {
 
         /* In order to be able to distinguish dependencies on
         different device nodes we might end up creating multiple
-        devices for the same sysfs path. We chain them up here. */
+        devices for the same sysfs path. We group them up here. */
 
-        LIST_FIELDS(struct Device, same_sysfs);
+        DeviceGroup *group;
 
         DeviceState state;
 };
 
+/* All device units of the same sysfs path, see
+ * Manager::devices_by_sysfs. One of them is the master, which all
+ * others follow. */
+struct DeviceGroup {
+        char *sysfs;
+
+        Unit **units;
+        unsigned n_units;
+
+        Unit *master;
+};
+
 extern const UnitVTable device_vtable;
 
 void device_fd_event(Manager *m, int events);
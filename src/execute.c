@@ -1536,6 +1536,9 @@ void exec_command_done(ExecCommand *c) {
 
         strv_free(c->argv);
         c->argv = NULL;
+
+        specifier_template_free(c->argv_template);
+        c->argv_template = NULL;
 }
 
 void exec_command_done_array(ExecCommand *c, unsigned n) {
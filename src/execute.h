@@ -38,6 +38,7 @@ struct CGroupBonding;
 
 #include "list.h"
 #include "util.h"
+#include "specifier.h"
 
 #define LOGGER_SOCKET "/run/systemd/logger"
 
@@ -91,6 +92,7 @@ struct ExecStatus {
 struct ExecCommand {
         char *path;
         char **argv;
+        SpecifierTemplate *argv_template;
         ExecStatus exec_status;
         LIST_FIELDS(ExecCommand, command); /* useful for chaining commands */
         bool ignore;
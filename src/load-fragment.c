@@ -558,6 +558,9 @@ static int config_parse_exec(
                 if (!(nce = new0(ExecCommand, 1)))
                         goto fail;
 
+                if (!(nce->argv_template = specifier_template_new_strv(n)))
+                        goto fail;
+
                 nce->argv = n;
                 nce->path = path;
                 nce->ignore = ignore;
@@ -580,31 +583,6 @@ fail:
         return -ENOMEM;
 }
 
-static int config_parse_usec(
-                const char *filename,
-                unsigned line,
-                const char *section,
-                const char *lvalue,
-                int ltype,
-                const char *rvalue,
-                void *data,
-                void *userdata) {
-
-        usec_t *usec = data;
-
-        assert(filename);
-        assert(lvalue);
-        assert(rvalue);
-        assert(data);
-
-        if (parse_usec(rvalue, usec) < 0) {
-                log_error("[%s:%u] Failed to parse time value, ignoring: %s", filename, line, rvalue);
-                return 0;
-        }
-
-        return 0;
-}
-
 static DEFINE_CONFIG_PARSE_ENUM(config_parse_service_type, service_type, ServiceType, "Failed to parse service type");
 static DEFINE_CONFIG_PARSE_ENUM(config_parse_service_restart, service_restart, ServiceRestart, "Failed to parse service restart specifier");
 
@@ -1328,7 +1306,6 @@ static int config_parse_path_spec(
         path_kill_slashes(s->path);
 
         s->type = b;
-        s->inotify_fd = -1;
 
         LIST_PREPEND(PathSpec, spec, p->specs, s);
 
@@ -1450,10 +1427,7 @@ static int config_parse_service_sockets(
                         continue;
                 }
 
-                if ((r = set_ensure_allocated(&s->configured_sockets, trivial_hash_func, trivial_compare_func)) < 0)
-                        return r;
-
-                if ((r = set_put(s->configured_sockets, sock)) < 0)
+                if ((r = service_add_configured_socket(s, SOCKET(sock))) < 0)
                         return r;
         }
 
@@ -1996,6 +1970,7 @@ static int load_from_path(Unit *u, const char *path) {
                 { "PipeSize",               config_parse_size,            0, &u->socket.pipe_size,                            "Socket"  },
                 { "FreeBind",               config_parse_bool,            0, &u->socket.free_bind,                            "Socket"  },
                 { "Transparent",            config_parse_bool,            0, &u->socket.transparent,                          "Socket"  },
+                { "ReusePortListeners",     config_parse_unsigned,        0, &u->socket.reuse_port_listeners,                 "Socket"  },
                 { "Broadcast",              config_parse_bool,            0, &u->socket.broadcast,                            "Socket"  },
                 { "TCPCongestion",          config_parse_string,          0, &u->socket.tcp_congestion,                       "Socket"  },
                 { "MessageQueueMaxMessages", config_parse_long,           0, &u->socket.mq_maxmsg,                            "Socket"  },
@@ -2032,6 +2007,7 @@ static int load_from_path(Unit *u, const char *path) {
                 { "Unit",                   config_parse_path_unit,       0, &u->path,                                        "Path"    },
                 { "MakeDirectory",          config_parse_bool,            0, &u->path.make_directory,                         "Path"    },
                 { "DirectoryMode",          config_parse_mode,            0, &u->path.directory_mode,                         "Path"    },
+                { "TriggerHoldOffSec",      config_parse_usec,            0, &u->path.trigger_holdoff_usec,                   "Path"    },
 
                 /* The [Install] section is ignored here. */
                 { "Alias",                  NULL,                         0, NULL,                                            "Install" },
@@ -38,13 +38,42 @@
 #include "sd-daemon.h"
 #include "tcpwrap.h"
 #include "def.h"
+#include "ratelimit.h"
 
 #define STREAMS_MAX 4096
 #define SERVER_FD_MAX 16
 #define TIMEOUT_MSEC ((int) (DEFAULT_EXIT_USEC/USEC_PER_MSEC))
 
+/* How many epoll events to handle in one go */
+#define EVENTS_MAX 64
+
+/* How many syslog messages to queue before we forward them in one go */
+#define SYSLOG_QUEUE_MAX 64
+
+/* How often to complain about messages syslog didn't take */
+#define SYSLOG_WARN_INTERVAL_USEC (10*USEC_PER_SEC)
+
+/* How much console output to keep around while the console is busy */
+#define CONSOLE_BUFFER_MAX (64*1024)
+
+/* How often to try opening the console again after failing to */
+#define CONSOLE_OPEN_INTERVAL_USEC (5*USEC_PER_SEC)
+
 typedef struct Stream Stream;
 
+/* A line queued for the syslog daemon. The message text itself is
+ * not copied, it still points into the buffer of the stream it came
+ * from. */
+typedef struct SyslogMessage {
+        char header_priority[16];
+        struct iovec iovec[5];
+        struct msghdr msghdr;
+        union {
+                struct cmsghdr cmsghdr;
+                uint8_t buf[CMSG_SPACE(sizeof(struct ucred))];
+        } control;
+} SyslogMessage;
+
 typedef struct Server {
         int syslog_fd;
         int kmsg_fd;
@@ -56,6 +85,27 @@ typedef struct Server {
 
         LIST_HEAD(Stream, streams);
         unsigned n_streams;
+
+        SyslogMessage syslog_queue[SYSLOG_QUEUE_MAX];
+        unsigned n_syslog_queue;
+
+        /* Messages we failed to forward since we last said so */
+        RateLimit syslog_warn_ratelimit;
+        unsigned long syslog_failed;
+
+        /* The syslog time header only changes once a second */
+        time_t header_time_sec;
+        char header_time[64];
+
+        /* Console output is written without blocking. Whatever the
+         * console cannot take right away is kept here, and if that
+         * overflows we drop lines. */
+        int console_fd;
+        uint32_t console_events;
+        RateLimit console_open_ratelimit;
+        char console_buffer[CONSOLE_BUFFER_MAX];
+        size_t console_length;
+        unsigned long console_dropped;
 } Server;
 
 typedef enum StreamTarget {
@@ -88,17 +138,418 @@ struct Stream {
         bool prefix:1;
         bool tee_console:1;
 
+        char header_pid[16];
+
+        /* Lines before offset have been processed, but might still
+         * be referenced from the syslog queue */
         char buffer[LINE_MAX];
-        size_t length;
+        size_t length, offset;
 
         LIST_FIELDS(Stream, stream);
 };
 
-static int stream_log(Stream *s, char *p, usec_t ts) {
+static int syslog_message_send(Server *s, SyslogMessage *m) {
+        struct ucred *ucred;
+
+        assert(s);
+        assert(m);
+
+        ucred = (struct ucred*) CMSG_DATA(&m->control.cmsghdr);
+
+        for (;;) {
+                ssize_t n;
+
+                if ((n = sendmsg(s->syslog_fd, &m->msghdr, MSG_NOSIGNAL)) < 0) {
+
+                        if (errno == ESRCH) {
+                                pid_t our_pid;
+
+                                /* Hmm, maybe the process this
+                                 * line originates from is
+                                 * dead? Then let's patch in
+                                 * our own pid and retry,
+                                 * since we have nothing
+                                 * better */
+
+                                our_pid = getpid();
+
+                                if (ucred->pid != our_pid) {
+                                        ucred->pid = our_pid;
+                                        continue;
+                                }
+                        }
+
+                        return -errno;
+                }
+
+                if (!s->syslog_is_stream ||
+                    (size_t) n >= IOVEC_TOTAL_SIZE(m->iovec, ELEMENTSOF(m->iovec)))
+                        break;
+
+                IOVEC_INCREMENT(m->iovec, ELEMENTSOF(m->iovec), n);
+        }
+
+        return 0;
+}
+
+static void server_flush(Server *s) {
+        unsigned i = 0, n_failed = 0;
+        int r = 0;
+
+        assert(s);
+
+        /* Forwards all queued syslog messages, using a single system
+         * call for the whole batch if we can. Messages we fail to
+         * forward are dropped. */
+
+        if (s->n_syslog_queue <= 0)
+                return;
+
+#ifdef HAVE_SENDMMSG
+        if (!s->syslog_is_stream) {
+                struct mmsghdr mmsghdr[SYSLOG_QUEUE_MAX];
+
+                zero(mmsghdr);
+                for (i = 0; i < s->n_syslog_queue; i++)
+                        mmsghdr[i].msg_hdr = s->syslog_queue[i].msghdr;
+
+                i = 0;
+                while (i < s->n_syslog_queue) {
+                        int k;
+
+                        if ((k = sendmmsg(s->syslog_fd, mmsghdr + i, s->n_syslog_queue - i, MSG_NOSIGNAL)) > 0) {
+                                i += k;
+                                continue;
+                        }
+
+                        if (k < 0 && errno == EINTR)
+                                continue;
+
+                        /* Let's retry this one on its own, in
+                         * order to deal with ESRCH */
+                        if ((k = syslog_message_send(s, s->syslog_queue + i)) < 0) {
+                                r = k;
+                                n_failed++;
+                        }
+
+                        i++;
+                }
+        }
+#endif
+
+        for (; i < s->n_syslog_queue; i++) {
+                int k;
+
+                if ((k = syslog_message_send(s, s->syslog_queue + i)) < 0) {
+                        r = k;
+                        n_failed++;
+                }
+        }
 
-        char header_priority[16], header_time[64], header_pid[16];
+        s->syslog_failed += n_failed;
+
+        if (n_failed > 0 && ratelimit_test(&s->syslog_warn_ratelimit)) {
+                log_warning("Failed to forward %lu messages to syslog: %s", s->syslog_failed, strerror(-r));
+                s->syslog_failed = 0;
+        }
+
+        s->n_syslog_queue = 0;
+}
+
+static const char *server_header_time(Server *s, usec_t ts) {
+        time_t t;
+        struct tm *tm;
+
+        assert(s);
+
+        t = (time_t) (ts / USEC_PER_SEC);
+
+        if (t == s->header_time_sec)
+                return s->header_time;
+
+        /* Queued messages still reference the old header */
+        server_flush(s);
+
+        s->header_time_sec = (time_t) -1;
+
+        if (!(tm = localtime(&t)))
+                return NULL;
+
+        if (strftime(s->header_time, sizeof(s->header_time), "%h %e %T ", tm) <= 0)
+                return NULL;
+
+        s->header_time_sec = t;
+        return s->header_time;
+}
+
+static int server_queue_syslog(Server *s, Stream *stream, int priority, char *p, usec_t ts) {
+        SyslogMessage *m;
+        struct ucred *ucred;
+        const char *header_time;
+
+        assert(s);
+        assert(stream);
+        assert(p);
+
+        if (!(header_time = server_header_time(s, ts)))
+                return -EINVAL;
+
+        if (s->n_syslog_queue >= SYSLOG_QUEUE_MAX)
+                server_flush(s);
+
+        m = s->syslog_queue + s->n_syslog_queue;
+
+        snprintf(m->header_priority, sizeof(m->header_priority), "<%i>", priority);
+        char_array_0(m->header_priority);
+
+        zero(m->control);
+        m->control.cmsghdr.cmsg_level = SOL_SOCKET;
+        m->control.cmsghdr.cmsg_type = SCM_CREDENTIALS;
+        m->control.cmsghdr.cmsg_len = CMSG_LEN(sizeof(struct ucred));
+
+        ucred = (struct ucred*) CMSG_DATA(&m->control.cmsghdr);
+        ucred->pid = stream->pid;
+        ucred->uid = stream->uid;
+        ucred->gid = stream->gid;
+
+        zero(m->iovec);
+        IOVEC_SET_STRING(m->iovec[0], m->header_priority);
+        IOVEC_SET_STRING(m->iovec[1], (char*) header_time);
+        IOVEC_SET_STRING(m->iovec[2], stream->process);
+        IOVEC_SET_STRING(m->iovec[3], stream->header_pid);
+        IOVEC_SET_STRING(m->iovec[4], p);
+
+        /* When using syslog via SOCK_STREAM separate the messages by NUL chars */
+        if (s->syslog_is_stream)
+                m->iovec[4].iov_len++;
+
+        zero(m->msghdr);
+        m->msghdr.msg_iov = m->iovec;
+        m->msghdr.msg_iovlen = ELEMENTSOF(m->iovec);
+        m->msghdr.msg_control = &m->control;
+        m->msghdr.msg_controllen = m->control.cmsghdr.cmsg_len;
+
+        s->n_syslog_queue++;
+        return 0;
+}
+
+static void server_console_close(Server *s) {
+        assert(s);
+
+        if (s->console_fd < 0)
+                return;
+
+        epoll_ctl(s->epoll_fd, EPOLL_CTL_DEL, s->console_fd, NULL);
+        close_nointr_nofail(s->console_fd);
+        s->console_fd = -1;
+
+        /* Whatever is still queued is lost. Every line we queue
+         * ends in a newline, even if we wrote part of it already. */
+        if (s->console_length > 0) {
+                const char *p = s->console_buffer, *e = s->console_buffer + s->console_length;
+
+                while ((p = memchr(p, '\n', e - p))) {
+                        s->console_dropped++;
+                        p++;
+                }
+
+                s->console_length = 0;
+        }
+}
+
+static int server_console_open(Server *s) {
+        struct epoll_event ev;
+        int fd;
+
+        assert(s);
+
+        if (s->console_fd >= 0)
+                return 0;
+
+        /* Opening a TTY might block for a while, so don't try that
+         * for every line */
+        if (!ratelimit_test(&s->console_open_ratelimit))
+                return -EAGAIN;
+
+        if ((fd = open_terminal("/dev/console", O_WRONLY|O_NOCTTY|O_NONBLOCK|O_CLOEXEC)) < 0) {
+                log_warning("Failed to open /dev/console: %s", strerror(-fd));
+                return fd;
+        }
+
+        /* We only ask for EPOLLOUT while there is something queued */
+        zero(ev);
+        ev.events = 0;
+        ev.data.ptr = &s->console_fd;
+        if (epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+                log_warning("Failed to add console fd to epoll object: %m");
+                close_nointr_nofail(fd);
+                return -errno;
+        }
+
+        s->console_fd = fd;
+        s->console_events = 0;
+        return 0;
+}
+
+static void server_console_watch(Server *s) {
+        struct epoll_event ev;
+        uint32_t events;
+
+        assert(s);
+        assert(s->console_fd >= 0);
+
+        events = s->console_length > 0 ? EPOLLOUT : 0;
+
+        if (events == s->console_events)
+                return;
+
+        zero(ev);
+        ev.events = events;
+        ev.data.ptr = &s->console_fd;
+        if (epoll_ctl(s->epoll_fd, EPOLL_CTL_MOD, s->console_fd, &ev) < 0) {
+                log_warning("Failed to update console fd in epoll object: %m");
+                server_console_close(s);
+                return;
+        }
+
+        s->console_events = events;
+}
+
+static void server_console_queue(Server *s, const struct iovec *iovec, unsigned n, size_t skip) {
+        unsigned i;
+
+        assert(s);
+
+        /* Appends the data to the console buffer, minus the first
+         * skip bytes which have already been written */
+
+        for (i = 0; i < n; i++) {
+                size_t l = iovec[i].iov_len;
+
+                if (skip >= l) {
+                        skip -= l;
+                        continue;
+                }
+
+                memcpy(s->console_buffer + s->console_length, (uint8_t*) iovec[i].iov_base + skip, l - skip);
+                s->console_length += l - skip;
+                skip = 0;
+        }
+}
+
+static void server_console_notice(Server *s) {
+        char buf[64];
+        struct iovec iovec;
+        ssize_t k;
+
+        assert(s);
+        assert(s->console_fd >= 0);
+
+        /* Tell the user when we had to skip something, right after
+         * whatever we queued before that went out */
+        if (s->console_length > 0 || s->console_dropped <= 0)
+                return;
+
+        snprintf(buf, sizeof(buf), "systemd-logger: %lu lines not shown\n", s->console_dropped);
+        char_array_0(buf);
+        s->console_dropped = 0;
+
+        IOVEC_SET_STRING(iovec, buf);
+
+        if ((k = writev(s->console_fd, &iovec, 1)) < 0) {
+
+                if (errno != EAGAIN) {
+                        server_console_close(s);
+                        return;
+                }
+
+                k = 0;
+        }
+
+        if ((size_t) k < iovec.iov_len) {
+                server_console_queue(s, &iovec, 1, (size_t) k);
+                server_console_watch(s);
+        }
+}
+
+static void server_console_write(Server *s, const struct iovec *iovec, unsigned n) {
+        ssize_t k = 0;
+
+        assert(s);
+        assert(iovec);
+
+        if (server_console_open(s) < 0) {
+                s->console_dropped++;
+                return;
+        }
+
+        server_console_notice(s);
+
+        if (s->console_fd < 0) {
+                s->console_dropped++;
+                return;
+        }
+
+        /* Keep the order of lines, hence only write directly if
+         * nothing is queued */
+        if (s->console_length <= 0) {
+
+                if ((k = writev(s->console_fd, iovec, n)) < 0) {
+
+                        if (errno != EAGAIN) {
+                                server_console_close(s);
+                                s->console_dropped++;
+                                return;
+                        }
+
+                        k = 0;
+                }
+
+                if ((size_t) k >= IOVEC_TOTAL_SIZE(iovec, n))
+                        return;
+
+        } else if (s->console_length + IOVEC_TOTAL_SIZE(iovec, n) > sizeof(s->console_buffer)) {
+                s->console_dropped++;
+                return;
+        }
+
+        /* If we wrote part of the line, the rest fits in any case,
+         * since the buffer was empty */
+        server_console_queue(s, iovec, n, (size_t) k);
+        server_console_watch(s);
+}
+
+static void server_console_flush(Server *s) {
+        ssize_t k;
+
+        assert(s);
+        assert(s->console_fd >= 0);
+
+        /* The console is ready again, write out what we queued */
+
+        if (s->console_length > 0) {
+                if ((k = write(s->console_fd, s->console_buffer, s->console_length)) < 0) {
+
+                        if (errno != EAGAIN)
+                                server_console_close(s);
+
+                        return;
+                }
+
+                memmove(s->console_buffer, s->console_buffer + k, s->console_length - k);
+                s->console_length -= k;
+        }
+
+        server_console_notice(s);
+
+        if (s->console_fd >= 0)
+                server_console_watch(s);
+}
+
+static int stream_log(Stream *s, char *p, usec_t ts) {
+        char header_priority[16];
         struct iovec iovec[5];
-        int priority;
+        int priority, r;
 
         assert(s);
         assert(p);
@@ -127,96 +578,22 @@ static int stream_log(Stream *s, char *p, usec_t ts) {
          *  We extend the latter to include the process name and pid.
          */
 
-        snprintf(header_priority, sizeof(header_priority), "<%i>", priority);
-        char_array_0(header_priority);
-
-        if (s->target == STREAM_SYSLOG) {
-                time_t t;
-                struct tm *tm;
-
-                t = (time_t) (ts / USEC_PER_SEC);
-                if (!(tm = localtime(&t)))
-                        return -EINVAL;
-
-                if (strftime(header_time, sizeof(header_time), "%h %e %T ", tm) <= 0)
-                        return -EINVAL;
-        }
-
-        snprintf(header_pid, sizeof(header_pid), "[%lu]: ", (unsigned long) s->pid);
-        char_array_0(header_pid);
-
-        zero(iovec);
-        IOVEC_SET_STRING(iovec[0], header_priority);
-
         if (s->target == STREAM_SYSLOG) {
-                struct msghdr msghdr;
-                union {
-                        struct cmsghdr cmsghdr;
-                        uint8_t buf[CMSG_SPACE(sizeof(struct ucred))];
-                } control;
-                struct ucred *ucred;
-
-                zero(control);
-                control.cmsghdr.cmsg_level = SOL_SOCKET;
-                control.cmsghdr.cmsg_type = SCM_CREDENTIALS;
-                control.cmsghdr.cmsg_len = CMSG_LEN(sizeof(struct ucred));
-
-                ucred = (struct ucred*) CMSG_DATA(&control.cmsghdr);
-                ucred->pid = s->pid;
-                ucred->uid = s->uid;
-                ucred->gid = s->gid;
-
-                IOVEC_SET_STRING(iovec[1], header_time);
-                IOVEC_SET_STRING(iovec[2], s->process);
-                IOVEC_SET_STRING(iovec[3], header_pid);
-                IOVEC_SET_STRING(iovec[4], p);
-
-                /* When using syslog via SOCK_STREAM separate the messages by NUL chars */
-                if (s->server->syslog_is_stream)
-                        iovec[4].iov_len++;
-
-                zero(msghdr);
-                msghdr.msg_iov = iovec;
-                msghdr.msg_iovlen = ELEMENTSOF(iovec);
-                msghdr.msg_control = &control;
-                msghdr.msg_controllen = control.cmsghdr.cmsg_len;
-
-                for (;;) {
-                        ssize_t n;
-
-                        if ((n = sendmsg(s->server->syslog_fd, &msghdr, MSG_NOSIGNAL)) < 0) {
-
-                                if (errno == ESRCH) {
-                                        pid_t our_pid;
-
-                                        /* Hmm, maybe the process this
-                                         * line originates from is
-                                         * dead? Then let's patch in
-                                         * our own pid and retry,
-                                         * since we have nothing
-                                         * better */
-
-                                        our_pid = getpid();
-
-                                        if (ucred->pid != our_pid) {
-                                                ucred->pid = our_pid;
-                                                continue;
-                                        }
-                                }
+                if ((r = server_queue_syslog(s->server, s, priority, p, ts)) < 0)
+                        return r;
 
-                                return -errno;
-                        }
+        } else if (s->target == STREAM_KMSG) {
 
-                        if (!s->server->syslog_is_stream ||
-                            (size_t) n >= IOVEC_TOTAL_SIZE(iovec, ELEMENTSOF(iovec)))
-                                break;
+                /* The kernel turns every write into a record of its
+                 * own, so we cannot batch these */
 
-                        IOVEC_INCREMENT(iovec, ELEMENTSOF(iovec), n);
-                }
+                snprintf(header_priority, sizeof(header_priority), "<%i>", priority);
+                char_array_0(header_priority);
 
-        } else if (s->target == STREAM_KMSG) {
+                zero(iovec);
+                IOVEC_SET_STRING(iovec[0], header_priority);
                 IOVEC_SET_STRING(iovec[1], s->process);
-                IOVEC_SET_STRING(iovec[2], header_pid);
+                IOVEC_SET_STRING(iovec[2], s->header_pid);
                 IOVEC_SET_STRING(iovec[3], p);
                 IOVEC_SET_STRING(iovec[4], (char*) "\n");
 
@@ -226,17 +603,12 @@ static int stream_log(Stream *s, char *p, usec_t ts) {
                 assert_not_reached("Unknown log target");
 
         if (s->tee_console) {
-                int console;
-
-                if ((console = open_terminal("/dev/console", O_WRONLY|O_NOCTTY|O_CLOEXEC)) >= 0) {
-                        IOVEC_SET_STRING(iovec[0], s->process);
-                        IOVEC_SET_STRING(iovec[1], header_pid);
-                        IOVEC_SET_STRING(iovec[2], p);
-                        IOVEC_SET_STRING(iovec[3], (char*) "\n");
-
-                        writev(console, iovec, 4);
-                }
+                IOVEC_SET_STRING(iovec[0], s->process);
+                IOVEC_SET_STRING(iovec[1], s->header_pid);
+                IOVEC_SET_STRING(iovec[2], p);
+                IOVEC_SET_STRING(iovec[3], (char*) "\n");
 
+                server_console_write(s->server, iovec, 4);
         }
 
         return 0;
@@ -318,8 +690,8 @@ static int stream_scan(Stream *s, usec_t ts) {
 
         assert(s);
 
-        p = s->buffer;
-        remaining = s->length;
+        p = s->buffer + s->offset;
+        remaining = s->length - s->offset;
         for (;;) {
                 char *newline;
 
@@ -334,10 +706,9 @@ static int stream_scan(Stream *s, usec_t ts) {
                 }
         }
 
-        if (p > s->buffer) {
-                memmove(s->buffer, p, remaining);
-                s->length = remaining;
-        }
+        /* The lines we just processed might still be queued, so we
+         * can only drop them from the buffer on the next read */
+        s->offset = p - s->buffer;
 
         return r;
 }
@@ -347,6 +718,14 @@ static int stream_process(Stream *s, usec_t ts) {
         int r;
         assert(s);
 
+        /* By now the syslog queue has been flushed, hence we can
+         * drop everything we already processed */
+        if (s->offset > 0) {
+                memmove(s->buffer, s->buffer + s->offset, s->length - s->offset);
+                s->length -= s->offset;
+                s->offset = 0;
+        }
+
         if ((l = read(s->fd, s->buffer+s->length, LINE_MAX-s->length)) < 0) {
 
                 if (errno == EAGAIN)
@@ -373,6 +752,9 @@ static void stream_free(Stream *s) {
         assert(s);
 
         if (s->server) {
+                /* Make sure nothing references our buffer anymore */
+                server_flush(s->server);
+
                 assert(s->server->n_streams > 0);
                 s->server->n_streams--;
                 LIST_REMOVE(Stream, stream, s->server->streams, s);
@@ -443,6 +825,9 @@ static int stream_new(Server *s, int server_fd) {
         stream->uid = ucred.uid;
         stream->gid = ucred.gid;
 
+        snprintf(stream->header_pid, sizeof(stream->header_pid), "[%lu]: ", (unsigned long) stream->pid);
+        char_array_0(stream->header_pid);
+
         stream->server = s;
         LIST_PREPEND(Stream, stream, s->streams, stream);
         s->n_streams ++;
@@ -472,6 +857,9 @@ static void server_done(Server *s) {
 
         if (s->kmsg_fd >= 0)
                 close_nointr_nofail(s->kmsg_fd);
+
+        if (s->console_fd >= 0)
+                close_nointr_nofail(s->console_fd);
 }
 
 static int server_init(Server *s, unsigned n_sockets) {
@@ -490,6 +878,10 @@ static int server_init(Server *s, unsigned n_sockets) {
         s->n_server_fd = n_sockets;
         s->syslog_fd = -1;
         s->kmsg_fd = -1;
+        s->console_fd = -1;
+        s->header_time_sec = (time_t) -1;
+        RATELIMIT_INIT(s->syslog_warn_ratelimit, SYSLOG_WARN_INTERVAL_USEC, 1);
+        RATELIMIT_INIT(s->console_open_ratelimit, CONSOLE_OPEN_INTERVAL_USEC, 1);
 
         if ((s->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
                 r = -errno;
@@ -570,7 +962,7 @@ fail:
         return r;
 }
 
-static int process_event(Server *s, struct epoll_event *ev) {
+static int process_event(Server *s, struct epoll_event *ev, usec_t ts) {
         int r;
 
         assert(s);
@@ -594,12 +986,23 @@ static int process_event(Server *s, struct epoll_event *ev) {
                         return r;
                 }
 
+        } else if (ev->data.ptr == &s->console_fd) {
+
+                /* We might have closed it in the meantime */
+                if (s->console_fd < 0)
+                        return 0;
+
+                if (ev->events & (EPOLLERR|EPOLLHUP)) {
+                        log_info("Console hung up.");
+                        server_console_close(s);
+                        return 0;
+                }
+
+                server_console_flush(s);
+
         } else {
-                usec_t ts;
                 Stream *stream = ev->data.ptr;
 
-                ts = now(CLOCK_REALTIME);
-
                 if (!(ev->events & EPOLLIN)) {
                         log_info("Got invalid event from epoll. (2)");
                         stream_free(stream);
@@ -657,11 +1060,12 @@ int main(int argc, char *argv[]) {
                   "STATUS=Processing requests...");
 
         for (;;) {
-                struct epoll_event event;
-                int k;
+                struct epoll_event events[EVENTS_MAX];
+                int k, i;
+                usec_t ts;
 
                 if ((k = epoll_wait(server.epoll_fd,
-                                    &event, 1,
+                                    events, ELEMENTSOF(events),
                                     server.n_streams <= 0 ? TIMEOUT_MSEC : -1)) < 0) {
 
                         if (errno == EINTR)
@@ -674,8 +1078,15 @@ int main(int argc, char *argv[]) {
                 if (k <= 0)
                         break;
 
-                if (process_event(&server, &event) < 0)
-                        goto fail;
+                /* Handle all streams that are ready, and then
+                 * forward everything they had to say in one go */
+                ts = now(CLOCK_REALTIME);
+
+                for (i = 0; i < k; i++)
+                        if (process_event(&server, events + i, ts) < 0)
+                                goto fail;
+
+                server_flush(&server);
         }
 
         r = EXIT_SUCCESS;
@@ -75,6 +75,7 @@ static bool arg_sysv_console = true;
 static bool arg_mount_auto = true;
 static bool arg_swap_auto = true;
 static char **arg_default_controllers = NULL;
+static usec_t arg_accounting_interval = DEFAULT_ACCOUNTING_INTERVAL_USEC;
 static ExecOutput arg_default_std_output = EXEC_OUTPUT_INHERIT;
 static ExecOutput arg_default_std_error = EXEC_OUTPUT_INHERIT;
 
@@ -514,6 +515,7 @@ static int parse_config_file(void) {
                 { "MountAuto",             config_parse_bool,         0, &arg_mount_auto,          "Manager" },
                 { "SwapAuto",              config_parse_bool,         0, &arg_swap_auto,           "Manager" },
                 { "DefaultControllers",    config_parse_strv,         0, &arg_default_controllers, "Manager" },
+                { "AccountingIntervalSec", config_parse_usec,         0, &arg_accounting_interval, "Manager" },
                 { "DefaultStandardOutput", config_parse_output,       0, &arg_default_std_output,  "Manager" },
                 { "DefaultStandardError",  config_parse_output,       0, &arg_default_std_error,   "Manager" },
                 { NULL, NULL, 0, NULL, NULL }
@@ -1206,6 +1208,9 @@ int main(int argc, char *argv[]) {
         if (arg_default_controllers)
                 manager_set_default_controllers(m, arg_default_controllers);
 
+        if ((r = manager_set_accounting_interval(m, arg_accounting_interval)) < 0)
+                log_warning("Failed to set up resource accounting, ignoring: %s", strerror(-r));
+
         if ((r = manager_startup(m, serialization, fds)) < 0)
                 log_error("Failed to fully start up daemon: %s", strerror(-r));
 
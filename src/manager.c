@@ -227,7 +227,7 @@ int manager_new(ManagerRunningAs running_as, Manager **_m) {
         m->audit_fd = -1;
 #endif
 
-        m->signal_watch.fd = m->mount_watch.fd = m->udev_watch.fd = m->epoll_fd = m->dev_autofs_fd = m->swap_watch.fd = -1;
+        m->signal_watch.fd = m->mount_watch.fd = m->udev_watch.fd = m->epoll_fd = m->dev_autofs_fd = m->swap_watch.fd = m->accounting_watch.fd = m->path_watch.fd = -1;
         m->current_job_id = 1; /* start as id #1, so that we can leave #0 around as "null-like" value */
 
         if (!(m->environment = strv_copy(environ)))
@@ -248,9 +248,6 @@ int manager_new(ManagerRunningAs running_as, Manager **_m) {
         if (!(m->watch_pids = hashmap_new(trivial_hash_func, trivial_compare_func)))
                 goto fail;
 
-        if (!(m->cgroup_bondings = hashmap_new(string_hash_func, string_compare_func)))
-                goto fail;
-
         if (!(m->watch_bus = hashmap_new(string_hash_func, string_compare_func)))
                 goto fail;
 
@@ -478,7 +475,6 @@ void manager_free(Manager *m) {
 
         strv_free(m->default_controllers);
 
-        hashmap_free(m->cgroup_bondings);
         set_free_free(m->unit_path_cache);
 
         free(m);
@@ -1187,6 +1183,35 @@ static void transaction_minimize_impact(Manager *m) {
         } while (again);
 }
 
+static void transaction_realize_cgroups(Manager *m) {
+        Iterator i;
+        Job *j;
+
+        assert(m);
+
+        /* Create the cgroups of everything this transaction is going
+         * to start in one pass, so that the processes spawned for the
+         * jobs only need to be attached. Errors are ignored here,
+         * exec_spawn() will try again and report them. */
+
+        HASHMAP_FOREACH(j, m->transaction_jobs, i) {
+
+                if (j->installed)
+                        continue;
+
+                if (j->type != JOB_START &&
+                    j->type != JOB_RELOAD_OR_START &&
+                    j->type != JOB_RESTART &&
+                    j->type != JOB_TRY_RESTART)
+                        continue;
+
+                if (!j->unit->meta.cgroup_bondings)
+                        continue;
+
+                cgroup_bonding_realize_list(j->unit->meta.cgroup_bondings);
+        }
+}
+
 static int transaction_apply(Manager *m, JobMode mode) {
         Iterator i;
         Job *j;
@@ -1220,6 +1245,8 @@ static int transaction_apply(Manager *m, JobMode mode) {
                         goto rollback;
         }
 
+        transaction_realize_cgroups(m);
+
         while ((j = hashmap_steal_first(m->transaction_jobs))) {
                 if (j->installed) {
                         /* log_debug("Skipping already installed job %s/%s as %u", j->unit->meta.id, job_type_to_string(j->type), (unsigned) j->id); */
@@ -1495,21 +1522,25 @@ static int transaction_add_job_and_dependencies(
                 return -ENOMEM;
 
         if (is_new && !ignore_requirements) {
-                Set *following;
+                Unit **following;
+                unsigned n, k;
 
                 /* If we are following some other unit, make sure we
                  * add all dependencies of everybody following. */
-                if (unit_following_set(ret->unit, &following) > 0) {
-                        SET_FOREACH(dep, following, i)
+                if (unit_following_set(ret->unit, &following, &n) > 0)
+                        for (k = 0; k < n; k++) {
+                                dep = following[k];
+
+                                if (dep == ret->unit)
+                                        continue;
+
                                 if ((r = transaction_add_job_and_dependencies(m, type, dep, ret, false, override, false, false, ignore_order, e, NULL)) < 0) {
                                         log_warning("Cannot add dependency job for unit %s, ignoring: %s", dep->meta.id, bus_error(e, r));
 
                                         if (e)
                                                 dbus_error_free(e);
                                 }
-
-                        set_free(following);
-                }
+                        }
 
                 /* Finally, recursively add in all dependencies. */
                 if (type == JOB_START || type == JOB_RELOAD_OR_START) {
@@ -1696,6 +1727,41 @@ int manager_add_job(Manager *m, JobType type, Unit *unit, JobMode mode, bool ove
         return 0;
 }
 
+int manager_add_jobs(Manager *m, JobType type, Unit **units, unsigned n_units, JobMode mode, bool override, DBusError *e) {
+        unsigned i;
+        int r;
+
+        assert(m);
+        assert(type < _JOB_TYPE_MAX);
+        assert(units || n_units <= 0);
+        assert(mode < _JOB_MODE_MAX);
+        assert(mode != JOB_ISOLATE);
+
+        /* Like manager_add_job(), but enqueues jobs for a number of
+         * units within a single transaction, so that it only needs
+         * to be verified and activated once. */
+
+        if (n_units <= 0)
+                return 0;
+
+        log_debug("Trying to enqueue %u %s jobs (%s), first is for %s", n_units, job_type_to_string(type), job_mode_to_string(mode), units[0]->meta.id);
+
+        for (i = 0; i < n_units; i++)
+                if ((r = transaction_add_job_and_dependencies(m, type, units[i], NULL, true, override, false,
+                                                              mode == JOB_IGNORE_DEPENDENCIES || mode == JOB_IGNORE_REQUIREMENTS,
+                                                              mode == JOB_IGNORE_DEPENDENCIES, e, NULL)) < 0) {
+                        transaction_abort(m);
+                        return r;
+                }
+
+        if ((r = transaction_activate(m, mode, e)) < 0)
+                return r;
+
+        log_debug("Enqueued %u jobs", n_units);
+
+        return 0;
+}
+
 int manager_add_job_by_name(Manager *m, JobType type, const char *name, JobMode mode, bool override, DBusError *e, Job **_ret) {
         Unit *unit;
         int r;
@@ -1778,7 +1844,7 @@ int manager_load_unit_prepare(Manager *m, const char *name, const char *path, DB
                 return 1;
         }
 
-        if (!(ret = unit_new(m)))
+        if (!(ret = unit_new(m, unit_vtable[unit_name_to_type(name)]->object_size)))
                 return -ENOMEM;
 
         if (path)
@@ -2338,6 +2404,28 @@ static int process_event(Manager *m, struct epoll_event *ev) {
                 bus_timeout_event(m, w, ev->events);
                 break;
 
+        case WATCH_CGROUP_ACCOUNTING: {
+                uint64_t v;
+                ssize_t k;
+
+                /* Time to take a new resource usage sample */
+                if ((k = read(w->fd, &v, sizeof(v))) != sizeof(v)) {
+
+                        if (k < 0 && (errno == EINTR || errno == EAGAIN))
+                                break;
+
+                        return k < 0 ? -errno : -EIO;
+                }
+
+                cgroup_accounting_sample(m);
+                break;
+        }
+
+        case WATCH_PATH:
+                /* Some file system path changed */
+                path_fd_event(m, ev->events);
+                break;
+
         default:
                 log_error("event type=%i", w->type);
                 assert_not_reached("Unknown epoll event type.");
@@ -67,7 +67,9 @@ enum WatchType {
         WATCH_SWAP,
         WATCH_UDEV,
         WATCH_DBUS_WATCH,
-        WATCH_DBUS_TIMEOUT
+        WATCH_DBUS_TIMEOUT,
+        WATCH_CGROUP_ACCOUNTING,
+        WATCH_PATH
 };
 
 struct Watch {
@@ -154,15 +156,16 @@ struct Manager {
         struct udev* udev;
         struct udev_monitor* udev_monitor;
         Watch udev_watch;
-        Hashmap *devices_by_sysfs;
+        Hashmap *devices_by_sysfs; /* sysfs path => DeviceGroup object 1:1 */
 
         /* Data specific to the mount subsystem */
-        FILE *proc_self_mountinfo;
+        struct MountTable *mount_table;
         Watch mount_watch;
+        struct MountNode *mount_root; /* path component trie => loaded Mount objects */
 
         /* Data specific to the swap filesystem */
         FILE *proc_swaps;
-        Hashmap *swaps_by_proc_swaps;
+        Hashmap *swaps_by_proc_swaps; /* swap device => SwapGroup object 1:1 */
         bool request_reload;
         Watch swap_watch;
 
@@ -183,13 +186,22 @@ struct Manager {
 
         uint32_t current_job_id;
 
+        /* Data specific to the path subsystem */
+        Watch path_watch;
+        Hashmap *path_inotify_wds; /* inotify wd => PathSpecWatch objects 1:n */
+        Set *path_triggered, *path_changed; /* Path objects, only non-empty while dispatching */
+
         /* Data specific to the Automount subsystem */
         int dev_autofs_fd;
 
         /* Data specific to the cgroup subsystem */
-        Hashmap *cgroup_bondings; /* path string => CGroupBonding object 1:n */
+        struct CGroupNode *cgroup_root; /* path component trie => CGroupBonding objects 1:n */
         char *cgroup_hierarchy;
 
+        /* Periodic resource usage sampling of all units */
+        Watch accounting_watch;
+        usec_t accounting_interval;
+
         usec_t gc_queue_timestamp;
         int gc_marker;
         unsigned n_in_gc_queue;
@@ -247,6 +259,7 @@ int manager_load_unit_prepare(Manager *m, const char *name, const char *path, DB
 int manager_load_unit(Manager *m, const char *name, const char *path, DBusError *e, Unit **_ret);
 
 int manager_add_job(Manager *m, JobType type, Unit *unit, JobMode mode, bool force, DBusError *e, Job **_ret);
+int manager_add_jobs(Manager *m, JobType type, Unit **units, unsigned n_units, JobMode mode, bool force, DBusError *e);
 int manager_add_job_by_name(Manager *m, JobType type, const char *name, JobMode mode, bool force, DBusError *e, Job **_ret);
 
 void manager_dump_units(Manager *s, FILE *f, const char *prefix);
@@ -0,0 +1,266 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2010 Lennart Poettering
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mount-table.h"
+#include "util.h"
+#include "log.h"
+
+/* The kernel generates the file in chunks of this size */
+#define MOUNT_TABLE_READ_CHUNK 4096
+
+MountTable *mount_table_new(void) {
+        MountTable *t;
+
+        if (!(t = new0(MountTable, 1)))
+                return NULL;
+
+        if (!(t->by_id = hashmap_new(trivial_hash_func, trivial_compare_func))) {
+                mount_table_free(t);
+                return NULL;
+        }
+
+        return t;
+}
+
+void mount_table_free(MountTable *t) {
+        assert(t);
+
+        hashmap_free(t->by_id);
+
+        free(t->entries);
+        free(t->buffer);
+        free(t);
+}
+
+static int mount_table_read(MountTable *t, int fd) {
+        size_t n = 0;
+
+        assert(t);
+        assert(fd >= 0);
+
+        /* The file is generated on the fly, so we cannot know its
+         * size in advance */
+
+        if (lseek(fd, 0, SEEK_SET) < 0)
+                return -errno;
+
+        for (;;) {
+                ssize_t k;
+
+                if (t->buffer_allocated - n < MOUNT_TABLE_READ_CHUNK + 1) {
+                        size_t l;
+                        char *b;
+
+                        l = MAX(t->buffer_allocated * 2, (size_t) 4 * MOUNT_TABLE_READ_CHUNK);
+
+                        if (!(b = realloc(t->buffer, l)))
+                                return -ENOMEM;
+
+                        t->buffer = b;
+                        t->buffer_allocated = l;
+                }
+
+                if ((k = read(fd, t->buffer + n, t->buffer_allocated - n - 1)) < 0) {
+
+                        if (errno == EINTR)
+                                continue;
+
+                        return -errno;
+                }
+
+                if (k == 0)
+                        break;
+
+                n += k;
+        }
+
+        t->buffer[n] = 0;
+        return 0;
+}
+
+static char *next_field(char **p) {
+        char *f, *e;
+
+        assert(p);
+
+        if (!(f = *p))
+                return NULL;
+
+        if ((e = strchr(f, ' '))) {
+                *e = 0;
+                *p = e + 1;
+        } else
+                *p = NULL;
+
+        return f;
+}
+
+static const char *unescape_octal(char *s) {
+        char *f, *t;
+
+        /* The kernel escapes whitespace and backslashes as \ooo. We
+         * can undo that in place, since it only makes strings
+         * shorter. */
+
+        for (f = t = s; *f; f++, t++) {
+                int a, b, c;
+
+                if (f[0] == '\\' &&
+                    (a = unoctchar(f[1])) >= 0 &&
+                    (b = unoctchar(f[2])) >= 0 &&
+                    (c = unoctchar(f[3])) >= 0) {
+                        *t = (char) ((a << 6) | (b << 3) | c);
+                        f += 3;
+                } else
+                        *t = *f;
+        }
+
+        *t = 0;
+        return s;
+}
+
+static int mount_table_parse_line(char *line, MountTableEntry *e) {
+        char *p = line, *f;
+        char *root, *path, *fstype, *source;
+        unsigned ma, mi;
+
+        assert(line);
+        assert(e);
+
+        zero(*e);
+
+        if (!(f = next_field(&p)) || safe_atou(f, &e->id) < 0)
+                return -EINVAL;
+
+        if (!(f = next_field(&p)) || safe_atou(f, &e->parent_id) < 0)
+                return -EINVAL;
+
+        if (!(f = next_field(&p)) || sscanf(f, "%u:%u", &ma, &mi) != 2)
+                return -EINVAL;
+
+        e->devnum = makedev(ma, mi);
+
+        if (!(root = next_field(&p)) ||
+            !(path = next_field(&p)) ||
+            !(e->options = next_field(&p)))
+                return -EINVAL;
+
+        /* Skip the optional fields */
+        do {
+                if (!(f = next_field(&p)))
+                        return -EINVAL;
+        } while (!streq(f, "-"));
+
+        if (!(fstype = next_field(&p)) ||
+            !(source = next_field(&p)) ||
+            !(e->super_options = next_field(&p)))
+                return -EINVAL;
+
+        e->root = unescape_octal(root);
+        e->path = unescape_octal(path);
+        e->fstype = unescape_octal(fstype);
+        e->source = unescape_octal(source);
+
+        return 0;
+}
+
+static int mount_table_index(MountTable *t) {
+        MountTableEntry *e;
+        int r;
+
+        assert(t);
+
+        MOUNT_TABLE_FOREACH(e, t)
+                if ((r = hashmap_replace(t->by_id, UINT_TO_PTR(e->id), e)) < 0)
+                        return r;
+
+        MOUNT_TABLE_FOREACH(e, t) {
+                MountTableEntry *p;
+
+                if ((p = hashmap_get(t->by_id, UINT_TO_PTR(e->parent_id))) && p != e)
+                        e->parent = p;
+        }
+
+        return 0;
+}
+
+int mount_table_load(MountTable *t, int fd) {
+        char *line, *eol;
+        unsigned i;
+        int r;
+
+        assert(t);
+
+        /* Loads a fresh snapshot of /proc/self/mountinfo from fd, or
+         * opens the file ourselves if fd is negative. Everything is
+         * parsed in place in a single buffer, so apart from the
+         * first few calls this does not allocate any memory. */
+
+        hashmap_clear(t->by_id);
+        t->n_entries = 0;
+
+        if (fd < 0) {
+                if ((fd = open("/proc/self/mountinfo", O_RDONLY|O_CLOEXEC)) < 0)
+                        return -errno;
+
+                r = mount_table_read(t, fd);
+                close_nointr_nofail(fd);
+        } else
+                r = mount_table_read(t, fd);
+
+        if (r < 0)
+                return r;
+
+        for (line = t->buffer, i = 1; *line; line = eol, i++) {
+
+                if ((eol = strchr(line, '\n')))
+                        *(eol++) = 0;
+                else
+                        eol = line + strlen(line);
+
+                if (t->n_entries >= t->n_entries_allocated) {
+                        unsigned n;
+                        MountTableEntry *a;
+
+                        n = MAX(t->n_entries_allocated * 2, 64U);
+
+                        if (!(a = realloc(t->entries, sizeof(MountTableEntry) * n)))
+                                return -ENOMEM;
+
+                        t->entries = a;
+                        t->n_entries_allocated = n;
+                }
+
+                if (mount_table_parse_line(line, t->entries + t->n_entries) < 0) {
+                        log_warning("Failed to parse /proc/self/mountinfo:%u.", i);
+                        continue;
+                }
+
+                t->n_entries++;
+        }
+
+        return mount_table_index(t);
+}
@@ -0,0 +1,71 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#ifndef foomounttablehfoo
+#define foomounttablehfoo
+
+/***
+  This file is part of systemd.
+
+  Copyright 2010 Lennart Poettering
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <sys/types.h>
+
+#include "hashmap.h"
+
+typedef struct MountTable MountTable;
+typedef struct MountTableEntry MountTableEntry;
+
+/* One line of /proc/self/mountinfo. All strings are unescaped and
+ * point into the buffer of the MountTable, so they are only valid
+ * until the next mount_table_load(). */
+struct MountTableEntry {
+        unsigned id;
+        unsigned parent_id;
+        dev_t devnum;
+
+        const char *root;
+        const char *path;
+        const char *options;
+        const char *fstype;
+        const char *source;
+        const char *super_options;
+
+        /* NULL if we cannot see the mount this one is mounted on */
+        MountTableEntry *parent;
+};
+
+/* A snapshot of /proc/self/mountinfo. Loading it again reuses all
+ * memory of the previous snapshot. */
+struct MountTable {
+        char *buffer;
+        size_t buffer_allocated;
+
+        MountTableEntry *entries;
+        unsigned n_entries, n_entries_allocated;
+
+        Hashmap *by_id; /* only used to resolve the parent links */
+};
+
+#define MOUNT_TABLE_FOREACH(e, t) \
+        for ((e) = (t)->entries; (e) < (t)->entries + (t)->n_entries; (e)++)
+
+MountTable *mount_table_new(void);
+void mount_table_free(MountTable *t);
+
+int mount_table_load(MountTable *t, int fd);
+
+#endif
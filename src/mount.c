@@ -20,6 +20,7 @@
 ***/
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <mntent.h>
 #include <sys/epoll.h>
@@ -32,6 +33,7 @@
 #include "log.h"
 #include "strv.h"
 #include "mount-setup.h"
+#include "mount-table.h"
 #include "unit-name.h"
 #include "dbus-mount.h"
 #include "special.h"
@@ -104,12 +106,16 @@ static void mount_parameters_done(MountParameters *p) {
         p->what = p->options = p->fstype = NULL;
 }
 
+static void mount_index_remove(Mount *m);
+
 static void mount_done(Unit *u) {
         Mount *m = MOUNT(u);
         Meta *other;
 
         assert(m);
 
+        mount_index_remove(m);
+
         free(m->where);
         m->where = NULL;
 
@@ -154,121 +160,452 @@ static MountParameters* get_mount_parameters(Mount *m) {
         return get_mount_parameters_configured(m);
 }
 
-static int mount_add_mount_links(Mount *m) {
-        Meta *other;
-        int r;
-        MountParameters *pm;
+static MountNode *mount_node_child(MountNode *n, const char *name, size_t l) {
+        char buf[NAME_MAX+1];
+
+        assert(n);
+
+        if (!n->children || l > NAME_MAX)
+                return NULL;
 
+        memcpy(buf, name, l);
+        buf[l] = 0;
+
+        return hashmap_get(n->children, buf);
+}
+
+static void mount_node_prune(Manager *m, MountNode *n) {
         assert(m);
 
-        pm = get_mount_parameters_configured(m);
+        /* Removes n and then its ancestors, as long as they are not
+         * needed anymore */
 
-        /* Adds in links to other mount points that might lie below or
-         * above us in the hierarchy */
+        while (n && !n->by_where && !n->by_what && set_isempty(n->units) && hashmap_isempty(n->children)) {
+                MountNode *parent = n->parent;
 
-        LIST_FOREACH(units_per_type, other, m->meta.manager->units_per_type[UNIT_MOUNT]) {
-                Mount *n = (Mount*) other;
-                MountParameters *pn;
+                if (parent)
+                        hashmap_remove(parent->children, n->name);
+                else {
+                        assert(m->mount_root == n);
+                        m->mount_root = NULL;
+                }
 
-                if (n == m)
-                        continue;
+                hashmap_free(n->children);
+                set_free(n->units);
+                free(n->name);
+                free(n);
+
+                n = parent;
+        }
+}
+
+static MountNode *mount_node_get(Manager *m, const char *path) {
+        MountNode *n;
+        size_t l;
+
+        assert(m);
+        assert(path);
+        assert(path_is_absolute(path));
 
-                if (n->meta.load_state != UNIT_LOADED)
+        if (!m->mount_root) {
+                if (!(m->mount_root = new0(MountNode, 1)))
+                        return NULL;
+
+                if (!(m->mount_root->name = strdup(""))) {
+                        free(m->mount_root);
+                        m->mount_root = NULL;
+                        return NULL;
+                }
+        }
+
+        n = m->mount_root;
+
+        while ((l = path_next_component(&path)) > 0) {
+                MountNode *c;
+
+                if ((c = mount_node_child(n, path, l))) {
+                        n = c;
+                        path += l;
                         continue;
+                }
 
-                pn = get_mount_parameters_configured(n);
+                if (l > NAME_MAX)
+                        goto fail;
 
-                if (path_startswith(m->where, n->where)) {
+                if (!n->children)
+                        if (!(n->children = hashmap_new(string_hash_func, string_compare_func)))
+                                goto fail;
 
-                        if ((r = unit_add_dependency(UNIT(m), UNIT_AFTER, UNIT(n), true)) < 0)
-                                return r;
+                if (!(c = new0(MountNode, 1)))
+                        goto fail;
 
-                        if (pn)
-                                if ((r = unit_add_dependency(UNIT(m), UNIT_REQUIRES, UNIT(n), true)) < 0)
-                                        return r;
+                if (!(c->name = strndup(path, l))) {
+                        free(c);
+                        goto fail;
+                }
 
-                } else if (path_startswith(n->where, m->where)) {
+                if (hashmap_put(n->children, c->name, c) < 0) {
+                        free(c->name);
+                        free(c);
+                        goto fail;
+                }
 
-                        if ((r = unit_add_dependency(UNIT(n), UNIT_AFTER, UNIT(m), true)) < 0)
-                                return r;
+                c->parent = n;
+                n = c;
+                path += l;
+        }
 
-                        if (pm)
-                                if ((r = unit_add_dependency(UNIT(n), UNIT_REQUIRES, UNIT(m), true)) < 0)
-                                        return r;
+        return n;
+
+fail:
+        mount_node_prune(m, n);
+        return NULL;
+}
 
-                } else if (pm && path_startswith(pm->what, n->where)) {
+MountNode *mount_node_root(Manager *m, const char *path) {
+        assert(m);
+        assert(path);
 
-                        if ((r = unit_add_dependency(UNIT(m), UNIT_AFTER, UNIT(n), true)) < 0)
-                                return r;
+        /* Mount points are absolute, hence relative paths can never
+         * lie below any of them */
+        if (!path_is_absolute(path))
+                return NULL;
 
-                        if ((r = unit_add_dependency(UNIT(m), UNIT_REQUIRES, UNIT(n), true)) < 0)
-                                return r;
+        return m->mount_root;
+}
 
-                } else if (pn && path_startswith(pn->what, m->where)) {
+MountNode *mount_node_next(MountNode *n, const char **path) {
+        size_t l;
+        MountNode *c;
 
-                        if ((r = unit_add_dependency(UNIT(n), UNIT_AFTER, UNIT(m), true)) < 0)
-                                return r;
+        assert(n);
+        assert(path);
 
-                        if ((r = unit_add_dependency(UNIT(n), UNIT_REQUIRES, UNIT(m), true)) < 0)
-                                return r;
+        if ((l = path_next_component(path)) <= 0)
+                return NULL;
+
+        if ((c = mount_node_child(n, *path, l)))
+                *path += l;
+
+        return c;
+}
+
+static MountNode *mount_node_find(Manager *m, const char *path) {
+        MountNode *n;
+        size_t l;
+
+        assert(m);
+        assert(path);
+
+        if (!(n = mount_node_root(m, path)))
+                return NULL;
+
+        while ((l = path_next_component(&path)) > 0) {
+                if (!(n = mount_node_child(n, path, l)))
+                        return NULL;
+
+                path += l;
+        }
+
+        return n;
+}
+
+int mount_index_add_unit(Unit *u, const char *path) {
+        MountNode *n;
+        int r;
+
+        assert(u);
+        assert(path);
+
+        /* Relative paths can never lie below a mount point */
+        if (!path_is_absolute(path))
+                return 0;
+
+        if (!(n = mount_node_get(u->meta.manager, path)))
+                return -ENOMEM;
+
+        if (!n->units)
+                if (!(n->units = set_new(trivial_hash_func, trivial_compare_func))) {
+                        mount_node_prune(u->meta.manager, n);
+                        return -ENOMEM;
                 }
+
+        if ((r = set_put(n->units, u)) < 0 && r != -EEXIST) {
+                mount_node_prune(u->meta.manager, n);
+                return r;
         }
 
         return 0;
 }
 
-static int mount_add_swap_links(Mount *m) {
-        Meta *other;
-        int r;
+void mount_index_remove_unit(Unit *u, const char *path) {
+        MountNode *n;
+
+        assert(u);
+        assert(path);
+
+        if (!(n = mount_node_find(u->meta.manager, path)))
+                return;
+
+        if (!set_remove(n->units, u))
+                return;
+
+        mount_node_prune(u->meta.manager, n);
+}
+
+static const char *mount_index_what(Mount *m) {
+        MountParameters *p;
+
+        assert(m);
+
+        /* Only What= settings that are paths can lie below another
+         * mount point */
+
+        if (!(p = get_mount_parameters_configured(m)))
+                return NULL;
+
+        if (!p->what || !path_is_absolute(p->what))
+                return NULL;
+
+        return p->what;
+}
+
+static void mount_index_remove_what(Mount *m) {
+        MountNode *n;
+
+        assert(m);
+
+        if (!(n = m->what_node))
+                return;
+
+        LIST_REMOVE(Mount, by_what, n->by_what, m);
+        m->what_node = NULL;
+
+        mount_node_prune(m->meta.manager, n);
+}
+
+static int mount_index_add_what(Mount *m) {
+        const char *what;
+        MountNode *n;
 
         assert(m);
+        assert(!m->what_node);
+
+        if (!(what = mount_index_what(m)))
+                return 0;
+
+        if (!(n = mount_node_get(m->meta.manager, what)))
+                return -ENOMEM;
+
+        LIST_PREPEND(Mount, by_what, n->by_what, m);
+        m->what_node = n;
+
+        return 0;
+}
+
+static int mount_index_add(Mount *m) {
+        MountNode *n;
 
-        LIST_FOREACH(units_per_type, other, m->meta.manager->units_per_type[UNIT_SWAP])
-                if ((r = swap_add_one_mount_link((Swap*) other, m)) < 0)
+        assert(m);
+        assert(m->where);
+        assert(!m->where_node);
+
+        /* mount_verify() will refuse this later on */
+        if (!path_is_absolute(m->where))
+                return 0;
+
+        if (!(n = mount_node_get(m->meta.manager, m->where)))
+                return -ENOMEM;
+
+        LIST_PREPEND(Mount, by_where, n->by_where, m);
+        m->where_node = n;
+
+        return mount_index_add_what(m);
+}
+
+static void mount_index_remove(Mount *m) {
+        MountNode *n;
+
+        assert(m);
+
+        mount_index_remove_what(m);
+
+        if (!(n = m->where_node))
+                return;
+
+        LIST_REMOVE(Mount, by_where, n->by_where, m);
+        m->where_node = NULL;
+
+        mount_node_prune(m->meta.manager, n);
+}
+
+static int mount_add_one_mount_link_above(Mount *m, Mount *n, bool requires) {
+        int r;
+
+        /* m lies below n, hence needs it */
+
+        if ((r = unit_add_dependency(UNIT(m), UNIT_AFTER, UNIT(n), true)) < 0)
+                return r;
+
+        if (requires)
+                if ((r = unit_add_dependency(UNIT(m), UNIT_REQUIRES, UNIT(n), true)) < 0)
                         return r;
 
         return 0;
 }
 
-static int mount_add_path_links(Mount *m) {
-        Meta *other;
+static int mount_add_mount_links_below(Mount *m, MountParameters *pm, MountNode *node) {
+        Mount *n;
+        MountNode *child;
+        Iterator i;
         int r;
 
         assert(m);
+        assert(node);
+
+        /* Adds links to all mounts in the subtree of node, which is
+         * the subtree of our mount point. */
+
+        LIST_FOREACH(by_where, n, node->by_where) {
+                if (n == m || n->meta.load_state != UNIT_LOADED)
+                        continue;
 
-        LIST_FOREACH(units_per_type, other, m->meta.manager->units_per_type[UNIT_PATH])
-                if ((r = path_add_one_mount_link((Path*) other, m)) < 0)
+                if ((r = mount_add_one_mount_link_above(n, m, !!pm)) < 0)
+                        return r;
+        }
+
+        LIST_FOREACH(by_what, n, node->by_what) {
+                if (n == m || n->meta.load_state != UNIT_LOADED)
+                        continue;
+
+                /* Already handled via the mount point */
+                if (path_startswith(m->where, n->where) ||
+                    path_startswith(n->where, m->where))
+                        continue;
+
+                if (pm && pm->what && path_startswith(pm->what, n->where))
+                        continue;
+
+                if ((r = mount_add_one_mount_link_above(n, m, true)) < 0)
+                        return r;
+        }
+
+        HASHMAP_FOREACH(child, node->children, i)
+                if ((r = mount_add_mount_links_below(m, pm, child)) < 0)
                         return r;
 
         return 0;
 }
 
-static int mount_add_automount_links(Mount *m) {
-        Meta *other;
+static int mount_add_mount_links(Mount *m) {
+        Mount *n;
+        MountNode *node;
+        MountParameters *pm;
+        const char *p;
         int r;
 
         assert(m);
 
-        LIST_FOREACH(units_per_type, other, m->meta.manager->units_per_type[UNIT_AUTOMOUNT])
-                if ((r = automount_add_one_mount_link((Automount*) other, m)) < 0)
+        pm = get_mount_parameters_configured(m);
+
+        /* Adds in links to other mount points that might lie below or
+         * above us in the hierarchy. Instead of checking all mounts
+         * we look only at the relevant parts of the mount index. */
+
+        /* Mount points above us */
+        p = m->where;
+        for (node = mount_node_root(m->meta.manager, p); node; node = mount_node_next(node, &p))
+                LIST_FOREACH(by_where, n, node->by_where) {
+                        if (n == m || n->meta.load_state != UNIT_LOADED)
+                                continue;
+
+                        if ((r = mount_add_one_mount_link_above(m, n, !!get_mount_parameters_configured(n))) < 0)
+                                return r;
+                }
+
+        /* Mount points and What= paths below us */
+        if (m->where_node)
+                if ((r = mount_add_mount_links_below(m, pm, m->where_node)) < 0)
                         return r;
 
+        /* Mount points above the path we mount */
+        if (pm && pm->what) {
+                p = pm->what;
+                for (node = mount_node_root(m->meta.manager, p); node; node = mount_node_next(node, &p))
+                        LIST_FOREACH(by_where, n, node->by_where) {
+                                if (n == m || n->meta.load_state != UNIT_LOADED)
+                                        continue;
+
+                                if (path_startswith(m->where, n->where) ||
+                                    path_startswith(n->where, m->where))
+                                        continue;
+
+                                if ((r = mount_add_one_mount_link_above(m, n, true)) < 0)
+                                        return r;
+                        }
+        }
+
         return 0;
 }
 
-static int mount_add_socket_links(Mount *m) {
-        Meta *other;
+static int mount_add_unit_links_below(Mount *m, MountNode *node) {
+        MountNode *child;
+        Iterator i;
+        Unit *u;
         int r;
 
         assert(m);
+        assert(node);
+
+        SET_FOREACH(u, node->units, i) {
+
+                switch (u->meta.type) {
+
+                case UNIT_SOCKET:
+                        r = socket_add_one_mount_link(SOCKET(u), m);
+                        break;
+
+                case UNIT_PATH:
+                        r = path_add_one_mount_link(PATH(u), m);
+                        break;
+
+                case UNIT_AUTOMOUNT:
+                        r = automount_add_one_mount_link(AUTOMOUNT(u), m);
+                        break;
+
+                case UNIT_SWAP:
+                        r = swap_add_one_mount_link(SWAP(u), m);
+                        break;
+
+                default:
+                        assert_not_reached("Unexpected unit type in mount index.");
+                }
+
+                if (r < 0)
+                        return r;
+        }
 
-        LIST_FOREACH(units_per_type, other, m->meta.manager->units_per_type[UNIT_SOCKET])
-                if ((r = socket_add_one_mount_link((Socket*) other, m)) < 0)
+        HASHMAP_FOREACH(child, node->children, i)
+                if ((r = mount_add_unit_links_below(m, child)) < 0)
                         return r;
 
         return 0;
 }
 
+static int mount_add_unit_links(Mount *m) {
+        assert(m);
+
+        /* Adds links from the socket, path, automount and swap units
+         * whose paths lie below us. They registered those paths in
+         * the mount index, hence we only need to look at our
+         * subtree. */
+
+        if (!m->where_node)
+                return 0;
+
+        return mount_add_unit_links_below(m, m->where_node);
+}
+
 static char* mount_test_option(const char *haystack, const char *needle) {
         struct mntent me;
 
@@ -594,6 +931,9 @@ static int mount_load(Unit *u) {
 
                 path_kill_slashes(m->where);
 
+                if ((r = mount_index_add(m)) < 0)
+                        return r;
+
                 if (!m->meta.description)
                         if ((r = unit_set_description(u, m->where)) < 0)
                                 return r;
@@ -604,16 +944,7 @@ static int mount_load(Unit *u) {
                 if ((r = mount_add_mount_links(m)) < 0)
                         return r;
 
-                if ((r = mount_add_socket_links(m)) < 0)
-                        return r;
-
-                if ((r = mount_add_swap_links(m)) < 0)
-                        return r;
-
-                if ((r = mount_add_path_links(m)) < 0)
-                        return r;
-
-                if ((r = mount_add_automount_links(m)) < 0)
+                if ((r = mount_add_unit_links(m)) < 0)
                         return r;
 
                 if ((r = mount_add_fstab_links(m)) < 0)
@@ -1399,7 +1730,7 @@ static int mount_add_one(
         if (!(u = manager_get_unit(m, e))) {
                 delete = true;
 
-                if (!(u = unit_new(m))) {
+                if (!(u = unit_new(m, sizeof(Mount)))) {
                         free(e);
                         return -ENOMEM;
                 }
@@ -1441,6 +1772,9 @@ static int mount_add_one(
         } else {
                 p = &MOUNT(u)->parameters_etc_fstab;
                 MOUNT(u)->from_etc_fstab = true;
+
+                /* The configured What= might change below */
+                mount_index_remove_what(MOUNT(u));
         }
 
         free(p->what);
@@ -1454,6 +1788,10 @@ static int mount_add_one(
 
         p->passno = passno;
 
+        if (MOUNT(u)->where_node && !MOUNT(u)->what_node)
+                if ((r = mount_index_add_what(MOUNT(u))) < 0)
+                        return r;
+
         unit_add_to_dbus_queue(u);
 
         return 0;
@@ -1553,89 +1891,40 @@ finish:
 }
 
 static int mount_load_proc_self_mountinfo(Manager *m, bool set_flags) {
-        int r = 0;
-        unsigned i;
-        char *device, *path, *options, *options2, *fstype, *d, *p, *o;
+        MountTableEntry *e;
+        int r = 0, k;
 
         assert(m);
 
-        rewind(m->proc_self_mountinfo);
-
-        for (i = 1;; i++) {
-                int k;
-
-                device = path = options = options2 = fstype = d = p = o = NULL;
-
-                if ((k = fscanf(m->proc_self_mountinfo,
-                                "%*s "       /* (1) mount id */
-                                "%*s "       /* (2) parent id */
-                                "%*s "       /* (3) major:minor */
-                                "%*s "       /* (4) root */
-                                "%ms "       /* (5) mount point */
-                                "%ms"        /* (6) mount options */
-                                "%*[^-]"     /* (7) optional fields */
-                                "- "         /* (8) separator */
-                                "%ms "       /* (9) file system type */
-                                "%ms"        /* (10) mount source */
-                                "%ms"        /* (11) mount options 2 */
-                                "%*[^\n]",   /* some rubbish at the end */
-                                &path,
-                                &options,
-                                &fstype,
-                                &device,
-                                &options2)) != 5) {
-
-                        if (k == EOF)
-                                break;
-
-                        log_warning("Failed to parse /proc/self/mountinfo:%u.", i);
-                        goto clean_up;
-                }
+        if ((r = mount_table_load(m->mount_table, m->mount_watch.fd)) < 0)
+                return r;
 
-                if (asprintf(&o, "%s,%s", options, options2) < 0) {
-                        r = -ENOMEM;
-                        goto finish;
-                }
+        MOUNT_TABLE_FOREACH(e, m->mount_table) {
+                char *o;
 
-                if (!(d = cunescape(device)) ||
-                    !(p = cunescape(path))) {
-                        r = -ENOMEM;
-                        goto finish;
-                }
+                if (asprintf(&o, "%s,%s", e->options, e->super_options) < 0)
+                        return -ENOMEM;
 
-                if ((k = mount_add_one(m, d, p, o, fstype, 0, true, set_flags)) < 0)
+                if ((k = mount_add_one(m, e->source, e->path, o, e->fstype, 0, true, set_flags)) < 0)
                         r = k;
 
-clean_up:
-                free(device);
-                free(path);
-                free(options);
-                free(options2);
-                free(fstype);
-                free(d);
-                free(p);
                 free(o);
         }
 
-finish:
-        free(device);
-        free(path);
-        free(options);
-        free(options2);
-        free(fstype);
-        free(d);
-        free(p);
-        free(o);
-
         return r;
 }
 
 static void mount_shutdown(Manager *m) {
         assert(m);
 
-        if (m->proc_self_mountinfo) {
-                fclose(m->proc_self_mountinfo);
-                m->proc_self_mountinfo = NULL;
+        if (m->mount_table) {
+                mount_table_free(m->mount_table);
+                m->mount_table = NULL;
+        }
+
+        if (m->mount_watch.fd >= 0) {
+                close_nointr_nofail(m->mount_watch.fd);
+                m->mount_watch.fd = -1;
         }
 }
 
@@ -1644,12 +1933,15 @@ static int mount_enumerate(Manager *m) {
         struct epoll_event ev;
         assert(m);
 
-        if (!m->proc_self_mountinfo) {
-                if (!(m->proc_self_mountinfo = fopen("/proc/self/mountinfo", "re")))
+        if (!m->mount_table)
+                if (!(m->mount_table = mount_table_new()))
+                        return -ENOMEM;
+
+        if (m->mount_watch.fd < 0) {
+                if ((m->mount_watch.fd = open("/proc/self/mountinfo", O_RDONLY|O_CLOEXEC)) < 0)
                         return -errno;
 
                 m->mount_watch.type = WATCH_MOUNT;
-                m->mount_watch.fd = fileno(m->proc_self_mountinfo);
 
                 zero(ev);
                 ev.events = EPOLLPRI;
@@ -1834,6 +2126,7 @@ DEFINE_STRING_TABLE_LOOKUP(mount_exec_command, MountExecCommand);
 
 const UnitVTable mount_vtable = {
         .suffix = ".mount",
+        .object_size = sizeof(Mount),
 
         .no_alias = true,
         .no_instances = true,
@@ -23,6 +23,7 @@
 ***/
 
 typedef struct Mount Mount;
+typedef struct MountNode MountNode;
 
 #include "unit.h"
 
@@ -95,10 +96,41 @@ struct Mount {
         pid_t control_pid;
 
         Watch timer_watch;
+
+        /* For the MountNode::by_where and MountNode::by_what lists */
+        LIST_FIELDS(Mount, by_where);
+        LIST_FIELDS(Mount, by_what);
+        MountNode *where_node, *what_node;
+};
+
+/* Loaded mount units are indexed in a path component trie rooted in
+ * Manager::mount_root. Each node lists the mounts whose Where= resp.
+ * configured What= is exactly its path, and the socket, path,
+ * automount and swap units that have a file system path there. Nodes
+ * that list nothing and have no children are removed. */
+struct MountNode {
+        char *name;
+        MountNode *parent;
+        Hashmap *children; /* component name => MountNode 1:1 */
+
+        LIST_HEAD(Mount, by_where);
+        LIST_HEAD(Mount, by_what);
+        Set *units;
 };
 
 extern const UnitVTable mount_vtable;
 
+/* Walk the trie along path: start with mount_node_root() and call
+ * mount_node_next() until it returns NULL, to visit the nodes of
+ * path and all its ancestors, root first. */
+MountNode *mount_node_root(Manager *m, const char *path);
+MountNode *mount_node_next(MountNode *n, const char **path);
+
+/* Units of other types register their paths here, so that a mount
+ * that is loaded after them finds them without scanning all units */
+int mount_index_add_unit(Unit *u, const char *path);
+void mount_index_remove_unit(Unit *u, const char *path);
+
 void mount_fd_event(Manager *m, int events);
 
 const char* mount_state_to_string(MountState i);
@@ -21,7 +21,6 @@
 
 #include <sys/inotify.h>
 #include <sys/epoll.h>
-#include <sys/ioctl.h>
 #include <errno.h>
 #include <unistd.h>
 
@@ -46,17 +45,42 @@ static void path_init(Unit *u) {
         assert(u->meta.load_state == UNIT_STUB);
 
         p->directory_mode = 0755;
+        p->timer_watch.type = WATCH_INVALID;
 }
 
 static void path_unwatch_one(Path *p, PathSpec *s) {
+        Manager *m;
+        unsigned i;
 
-        if (s->inotify_fd < 0)
-                return;
+        assert(p);
+        assert(s);
 
-        unit_unwatch_fd(UNIT(p), &s->watch);
+        m = p->meta.manager;
 
-        close_nointr_nofail(s->inotify_fd);
-        s->inotify_fd = -1;
+        for (i = 0; i < s->n_watches; i++) {
+                PathSpecWatch *w = s->watches + i, *first;
+
+                /* Dropped by the kernel already? */
+                if (w->wd < 0)
+                        continue;
+
+                first = hashmap_get(m->path_inotify_wds, INT_TO_PTR(w->wd));
+                LIST_REMOVE(PathSpecWatch, by_wd, first, w);
+
+                if (first)
+                        hashmap_replace(m->path_inotify_wds, INT_TO_PTR(w->wd), first);
+                else {
+                        /* We were the last ones interested in this
+                         * inode */
+                        hashmap_remove(m->path_inotify_wds, INT_TO_PTR(w->wd));
+                        inotify_rm_watch(m->path_watch.fd, w->wd);
+                }
+        }
+
+        free(s->watches);
+        s->watches = NULL;
+        s->n_watches = 0;
+        s->primary_wd = -1;
 }
 
 static void path_done(Unit *u) {
@@ -65,8 +89,11 @@ static void path_done(Unit *u) {
 
         assert(p);
 
+        unit_unwatch_timer(u, &p->timer_watch);
+
         while ((s = p->specs)) {
                 path_unwatch_one(p, s);
+                mount_index_remove_unit(u, s->path);
                 LIST_REMOVE(PathSpec, spec, p->specs, s);
                 free(s->path);
                 free(s);
@@ -97,15 +124,29 @@ int path_add_one_mount_link(Path *p, Mount *m) {
 }
 
 static int path_add_mount_links(Path *p) {
-        Meta *other;
+        PathSpec *s;
         int r;
 
         assert(p);
 
-        LIST_FOREACH(units_per_type, other, p->meta.manager->units_per_type[UNIT_MOUNT])
-                if ((r = path_add_one_mount_link(p, (Mount*) other)) < 0)
+        /* Only the mount points above our paths are relevant, hence
+         * look them up in the mount index. Mounts loaded later find
+         * us there, too. */
+
+        LIST_FOREACH(spec, s, p->specs) {
+                const char *path = s->path;
+                MountNode *n;
+                Mount *m;
+
+                if ((r = mount_index_add_unit(UNIT(p), path)) < 0)
                         return r;
 
+                for (n = mount_node_root(p->meta.manager, path); n; n = mount_node_next(n, &path))
+                        LIST_FOREACH(by_where, m, n->by_where)
+                                if ((r = path_add_one_mount_link(p, m)) < 0)
+                                        return r;
+        }
+
         return 0;
 }
 
@@ -180,11 +221,23 @@ static void path_dump(Unit *u, FILE *f, const char *prefix) {
                 "%sPath State: %s\n"
                 "%sUnit: %s\n"
                 "%sMakeDirectory: %s\n"
-                "%sDirectoryMode: %04o\n",
+                "%sDirectoryMode: %04o\n"
+                "%sNEvents: %u\n"
+                "%sNTriggers: %u\n",
                 prefix, path_state_to_string(p->state),
                 prefix, p->unit->meta.id,
                 prefix, yes_no(p->make_directory),
-                prefix, p->directory_mode);
+                prefix, p->directory_mode,
+                prefix, p->n_events,
+                prefix, p->n_triggers);
+
+        if (p->trigger_holdoff_usec > 0) {
+                char buf[FORMAT_TIMESPAN_MAX];
+
+                fprintf(f,
+                        "%sTriggerHoldOffSec: %s\n",
+                        prefix, format_timespan(buf, sizeof(buf), p->trigger_holdoff_usec));
+        }
 
         LIST_FOREACH(spec, s, p->specs)
                 fprintf(f,
@@ -194,6 +247,84 @@ static void path_dump(Unit *u, FILE *f, const char *prefix) {
                         s->path);
 }
 
+static int path_inotify_setup(Manager *m) {
+        struct epoll_event ev;
+        int r;
+
+        assert(m);
+
+        /* All path units share one inotify instance, which we create
+         * when the first one starts watching */
+
+        if (m->path_watch.fd >= 0)
+                return 0;
+
+        if (!m->path_inotify_wds)
+                if (!(m->path_inotify_wds = hashmap_new(trivial_hash_func, trivial_compare_func)))
+                        return -ENOMEM;
+
+        if (!m->path_triggered)
+                if (!(m->path_triggered = set_new(trivial_hash_func, trivial_compare_func)))
+                        return -ENOMEM;
+
+        if (!m->path_changed)
+                if (!(m->path_changed = set_new(trivial_hash_func, trivial_compare_func)))
+                        return -ENOMEM;
+
+        if ((m->path_watch.fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC)) < 0)
+                return -errno;
+
+        m->path_watch.type = WATCH_PATH;
+
+        zero(ev);
+        ev.events = EPOLLIN;
+        ev.data.ptr = &m->path_watch;
+
+        if (epoll_ctl(m->epoll_fd, EPOLL_CTL_ADD, m->path_watch.fd, &ev) < 0) {
+                r = -errno;
+                close_nointr_nofail(m->path_watch.fd);
+                m->path_watch.fd = -1;
+                return r;
+        }
+
+        return 0;
+}
+
+static int path_add_watch(Path *p, PathSpec *s, const char *path, uint32_t mask) {
+        Manager *m;
+        PathSpecWatch *w, *first;
+        int wd, r;
+
+        assert(p);
+        assert(s);
+        assert(path);
+
+        m = p->meta.manager;
+
+        /* Others might watch the same inode, hence only add to the
+         * mask, never replace it */
+        if ((wd = inotify_add_watch(m->path_watch.fd, path, mask|IN_MASK_ADD)) < 0)
+                return -errno;
+
+        w = s->watches + s->n_watches;
+        w->owner = p;
+        w->spec = s;
+        w->wd = wd;
+        w->mask = mask;
+
+        first = hashmap_get(m->path_inotify_wds, INT_TO_PTR(wd));
+        LIST_PREPEND(PathSpecWatch, by_wd, first, w);
+
+        if ((r = hashmap_replace(m->path_inotify_wds, INT_TO_PTR(wd), first)) < 0) {
+                /* This can only fail for a new wd */
+                inotify_rm_watch(m->path_watch.fd, wd);
+                return r;
+        }
+
+        s->n_watches++;
+        return wd;
+}
+
 static int path_watch_one(Path *p, PathSpec *s) {
         static const int flags_table[_PATH_TYPE_MAX] = {
                 [PATH_EXISTS] = IN_DELETE_SELF|IN_MOVE_SELF|IN_ATTRIB,
@@ -203,6 +334,7 @@ static int path_watch_one(Path *p, PathSpec *s) {
 
         bool exists = false;
         char *k, *slash;
+        unsigned n;
         int r;
 
         assert(p);
@@ -210,21 +342,27 @@ static int path_watch_one(Path *p, PathSpec *s) {
 
         path_unwatch_one(p, s);
 
+        if ((r = path_inotify_setup(p->meta.manager)) < 0)
+                return r;
+
         if (!(k = strdup(s->path)))
                 return -ENOMEM;
 
-        if ((s->inotify_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC)) < 0) {
-                r = -errno;
-                goto fail;
-        }
+        /* One watch for the path and one for each parent directory */
+        for (n = 1, slash = k; *slash; slash++)
+                if (*slash == '/')
+                        n++;
 
-        if (unit_watch_fd(UNIT(p), s->inotify_fd, EPOLLIN, &s->watch) < 0) {
-                r = -errno;
+        if (!(s->watches = new(PathSpecWatch, n))) {
+                r = -ENOMEM;
                 goto fail;
         }
 
-        if ((s->primary_wd = inotify_add_watch(s->inotify_fd, k, flags_table[s->type])) >= 0)
+        if ((r = path_add_watch(p, s, k, flags_table[s->type])) >= 0) {
+                s->primary_wd = r;
                 exists = true;
+        } else if (r == -ENOMEM)
+                goto fail;
 
         do {
                 int flags;
@@ -240,10 +378,13 @@ static int path_watch_one(Path *p, PathSpec *s) {
                 if (!exists)
                         flags |= IN_DELETE_SELF | IN_ATTRIB | IN_CREATE | IN_MOVED_TO;
 
-                if (inotify_add_watch(s->inotify_fd, k, flags) >= 0)
+                if ((r = path_add_watch(p, s, k, flags)) >= 0)
                         exists = true;
+                else if (r == -ENOMEM)
+                        goto fail;
         } while (slash != k);
 
+        free(k);
         return 0;
 
 fail:
@@ -286,6 +427,11 @@ static void path_set_state(Path *p, PathState state) {
             (state != PATH_RUNNING || p->inotify_triggered))
                 path_unwatch(p);
 
+        if (state != PATH_WAITING && state != PATH_RUNNING) {
+                unit_unwatch_timer(UNIT(p), &p->timer_watch);
+                p->trigger_pending = p->trigger_changed = false;
+        }
+
         if (state != old_state)
                 log_debug("%s changed %s -> %s",
                           p->meta.id,
@@ -338,6 +484,7 @@ static void path_enter_running(Path *p) {
         if ((r = manager_add_job(p->meta.manager, JOB_START, p->unit, JOB_REPLACE, true, &error, NULL)) < 0)
                 goto fail;
 
+        p->n_triggers++;
         p->inotify_triggered = false;
 
         if ((r = path_watch(p)) < 0)
@@ -481,6 +628,8 @@ static int path_serialize(Unit *u, FILE *f, FDSet *fds) {
         assert(fds);
 
         unit_serialize_item(u, f, "state", path_state_to_string(p->state));
+        unit_serialize_item_format(u, f, "n-events", "%u", p->n_events);
+        unit_serialize_item_format(u, f, "n-triggers", "%u", p->n_triggers);
 
         return 0;
 }
@@ -500,6 +649,20 @@ static int path_deserialize_item(Unit *u, const char *key, const char *value, FD
                         log_debug("Failed to parse state value %s", value);
                 else
                         p->deserialized_state = state;
+        } else if (streq(key, "n-events")) {
+                unsigned k;
+
+                if (safe_atou(value, &k) < 0)
+                        log_debug("Failed to parse n-events value %s", value);
+                else
+                        p->n_events = k;
+        } else if (streq(key, "n-triggers")) {
+                unsigned k;
+
+                if (safe_atou(value, &k) < 0)
+                        log_debug("Failed to parse n-triggers value %s", value);
+                else
+                        p->n_triggers = k;
         } else
                 log_debug("Unknown serialization key '%s'", key);
 
@@ -518,68 +681,106 @@ static const char *path_sub_state_to_string(Unit *u) {
         return path_state_to_string(PATH(u)->state);
 }
 
-static void path_fd_event(Unit *u, int fd, uint32_t events, Watch *w) {
+static void path_trigger(Path *p, bool changed) {
+        int r;
+
+        assert(p);
+
+        /* Check our paths now, and then hold off further checks for
+         * a while, if so configured */
+        if (p->trigger_holdoff_usec > 0)
+                if ((r = unit_watch_timer(UNIT(p), p->trigger_holdoff_usec, &p->timer_watch)) < 0)
+                        log_warning("%s failed to install hold-off timer, ignoring: %s", p->meta.id, strerror(-r));
+
+        if (changed)
+                path_enter_running(p);
+        else
+                path_enter_waiting(p, false, true);
+}
+
+static void path_timer_event(Unit *u, uint64_t elapsed, Watch *w) {
         Path *p = PATH(u);
-        int l;
-        ssize_t k;
-        uint8_t *buf = NULL;
-        struct inotify_event *e;
-        PathSpec *s;
         bool changed;
 
         assert(p);
-        assert(fd >= 0);
+        assert(elapsed == 1);
+        assert(w == &p->timer_watch);
 
-        if (p->state != PATH_WAITING &&
-            p->state != PATH_RUNNING)
+        /* Nothing happened during the hold-off window */
+        if (!p->trigger_pending) {
+                unit_unwatch_timer(u, &p->timer_watch);
                 return;
-
-        /* log_debug("inotify wakeup on %s.", u->meta.id); */
-
-        if (events != EPOLLIN) {
-                log_error("Got Invalid poll event on inotify.");
-                goto fail;
         }
 
-        LIST_FOREACH(spec, s, p->specs)
-                if (s->inotify_fd == fd)
-                        break;
+        changed = p->trigger_changed;
+        p->trigger_pending = p->trigger_changed = false;
 
-        if (!s) {
-                log_error("Got event on unknown fd.");
-                goto fail;
-        }
+        log_debug("%s hold-off window over, checking coalesced events.", u->meta.id);
+        path_trigger(p, changed);
+}
 
-        if (ioctl(fd, FIONREAD, &l) < 0) {
-                log_error("FIONREAD failed: %s", strerror(errno));
-                goto fail;
-        }
+void path_fd_event(Manager *m, uint32_t events) {
+        uint8_t inotify_buffer[sizeof(struct inotify_event) + FILENAME_MAX];
+        struct inotify_event *e;
+        Path *p;
+        ssize_t k;
 
-        assert(l > 0);
+        assert(m);
 
-        if (!(buf = malloc(l))) {
-                log_error("Failed to allocate buffer: %s", strerror(-ENOMEM));
-                goto fail;
+        if (events != EPOLLIN) {
+                log_error("Got invalid poll event on path inotify fd.");
+                return;
         }
 
-        if ((k = read(fd, buf, l)) < 0) {
-                log_error("Failed to read inotify event: %s", strerror(-errno));
-                goto fail;
+        if ((k = read(m->path_watch.fd, &inotify_buffer, sizeof(inotify_buffer))) < 0) {
+                if (errno != EAGAIN && errno != EINTR)
+                        log_error("Failed to read inotify event: %m");
+                return;
         }
 
-        /* If we are already running, then remember that one event was
-         * dispatched so that we restart the service only if something
-         * actually changed on disk */
-        p->inotify_triggered = true;
+        /* First figure out which path units are affected, then
+         * dispatch each of them once. Whatever we haven't read yet
+         * epoll will tell us about again. Both sets are drained
+         * below, so they are empty again when we return. */
 
-        e = (struct inotify_event*) buf;
+        e = (struct inotify_event*) inotify_buffer;
 
-        changed = false;
         while (k > 0) {
+                PathSpecWatch *w, *first;
                 size_t step;
 
-                if (s->type == PATH_CHANGED && s->primary_wd == e->wd)
-                        changed = true;
+                if (e->mask & IN_Q_OVERFLOW) {
+                        Meta *meta;
+
+                        /* We lost events, so recheck everything */
+                        LIST_FOREACH(units_per_type, meta, m->units_per_type[UNIT_PATH])
+                                set_put(m->path_triggered, meta);
+
+                } else if ((first = hashmap_get(m->path_inotify_wds, INT_TO_PTR(e->wd)))) {
+
+                        LIST_FOREACH(by_wd, w, first) {
+
+                                /* The kernel always sends these, but
+                                 * otherwise only what somebody asked
+                                 * for, which might not have been us */
+                                if (!(e->mask & (w->mask|IN_IGNORED|IN_UNMOUNT)))
+                                        continue;
+
+                                w->owner->n_events++;
+                                set_put(m->path_triggered, w->owner);
+
+                                if (w->spec->type == PATH_CHANGED && w->spec->primary_wd == e->wd)
+                                        set_put(m->path_changed, w->owner);
+                        }
+
+                        if (e->mask & IN_IGNORED) {
+                                /* The kernel dropped the wd already */
+                                LIST_FOREACH(by_wd, w, first)
+                                        w->wd = -1;
+
+                                hashmap_remove(m->path_inotify_wds, INT_TO_PTR(e->wd));
+                        }
+                }
 
                 step = sizeof(struct inotify_event) + e->len;
                 assert(step <= (size_t) k);
@@ -588,18 +789,33 @@ static void path_fd_event(Unit *u, int fd, uint32_t events, Watch *w) {
                 k -= step;
         }
 
-        if (changed)
-                path_enter_running(p);
-        else
-                path_enter_waiting(p, false, true);
+        while ((p = set_steal_first(m->path_triggered))) {
 
-        free(buf);
+                if (p->state != PATH_WAITING &&
+                    p->state != PATH_RUNNING)
+                        continue;
 
-        return;
+                /* If we are already running, then remember that one
+                 * event was dispatched so that we restart the service
+                 * only if something actually changed on disk */
+                p->inotify_triggered = true;
 
-fail:
-        free(buf);
-        path_enter_dead(p, false);
+                /* Within the hold-off window we just remember that
+                 * something happened */
+                if (p->timer_watch.type == WATCH_UNIT_TIMER) {
+                        p->trigger_pending = true;
+
+                        if (set_remove(m->path_changed, p))
+                                p->trigger_changed = true;
+
+                        continue;
+                }
+
+                path_trigger(p, !!set_remove(m->path_changed, p));
+        }
+
+        /* Units we skipped above might still be listed here */
+        set_clear(m->path_changed);
 }
 
 void path_unit_notify(Unit *u, UnitActiveState new_state) {
@@ -661,6 +877,24 @@ static void path_reset_failed(Unit *u) {
         p->failure = false;
 }
 
+static void path_shutdown(Manager *m) {
+        assert(m);
+
+        if (m->path_watch.fd >= 0) {
+                close_nointr_nofail(m->path_watch.fd);
+                m->path_watch.fd = -1;
+        }
+
+        hashmap_free(m->path_inotify_wds);
+        m->path_inotify_wds = NULL;
+
+        set_free(m->path_triggered);
+        m->path_triggered = NULL;
+
+        set_free(m->path_changed);
+        m->path_changed = NULL;
+}
+
 static const char* const path_state_table[_PATH_STATE_MAX] = {
         [PATH_DEAD] = "dead",
         [PATH_WAITING] = "waiting",
@@ -680,6 +914,7 @@ DEFINE_STRING_TABLE_LOOKUP(path_type, PathType);
 
 const UnitVTable path_vtable = {
         .suffix = ".path",
+        .object_size = sizeof(Path),
 
         .init = path_init,
         .done = path_done,
@@ -698,10 +933,12 @@ const UnitVTable path_vtable = {
         .active_state = path_active_state,
         .sub_state_to_string = path_sub_state_to_string,
 
-        .fd_event = path_fd_event,
+        .timer_event = path_timer_event,
 
         .reset_failed = path_reset_failed,
 
+        .shutdown = path_shutdown,
+
         .bus_interface = "org.freedesktop.systemd1.Path",
         .bus_message_handler = bus_path_message_handler
 };
@@ -44,20 +44,36 @@ typedef enum PathType {
         _PATH_TYPE_INVALID = -1
 } PathType;
 
-typedef struct PathSpec {
-        char *path;
+typedef struct PathSpec PathSpec;
+
+/* One inotify watch of a PathSpec on the inotify instance shared by
+ * all path units. The kernel returns the same wd when the same inode
+ * is watched twice, so several of these may share a wd. They are
+ * chained up in Manager::path_inotify_wds. */
+typedef struct PathSpecWatch {
+        Path *owner;
+        PathSpec *spec;
+
+        int wd;
+        uint32_t mask;
 
-        Watch watch;
+        LIST_FIELDS(struct PathSpecWatch, by_wd);
+} PathSpecWatch;
+
+struct PathSpec {
+        char *path;
 
         LIST_FIELDS(struct PathSpec, spec);
 
         PathType type;
-        int inotify_fd;
         int primary_wd;
 
-        bool previous_exists;
+        /* The path itself and all its parent directories */
+        PathSpecWatch *watches;
+        unsigned n_watches;
 
-} PathSpec;
+        bool previous_exists;
+};
 
 struct Path {
         Meta meta;
@@ -73,6 +89,16 @@ struct Path {
 
         bool make_directory;
         mode_t directory_mode;
+
+        /* After checking the paths, wait this long before checking
+         * again, and coalesce all events in between */
+        usec_t trigger_holdoff_usec;
+        Watch timer_watch;
+        bool trigger_pending;
+        bool trigger_changed;
+
+        unsigned n_events;
+        unsigned n_triggers;
 };
 
 void path_unit_notify(Unit *u, UnitActiveState new_state);
@@ -83,6 +109,8 @@ int path_add_one_mount_link(Path *p, Mount *m);
 
 extern const UnitVTable path_vtable;
 
+void path_fd_event(Manager *m, uint32_t events);
+
 const char* path_state_to_string(PathState i);
 PathState path_state_from_string(const char *s);
 
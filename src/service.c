@@ -198,6 +198,7 @@ static void service_connection_unref(Service *s) {
 
 static void service_done(Unit *u) {
         Service *s = SERVICE(u);
+        Socket *sock;
 
         assert(s);
 
@@ -234,7 +235,11 @@ static void service_done(Unit *u) {
         service_close_socket_fd(s);
         service_connection_unref(s);
 
+        while ((sock = set_steal_first(s->configured_sockets)))
+                set_remove(sock->configured_services, s);
+
         set_free(s->configured_sockets);
+        s->configured_sockets = NULL;
 
         unit_unwatch_timer(u, &s->timer_watch);
 }
@@ -434,6 +439,13 @@ static ExecCommand *exec_command_new(const char *path, const char *arg1) {
                 return NULL;
         }
 
+        if (!(c->argv_template = specifier_template_new_strv(c->argv))) {
+                strv_free(c->argv);
+                free(c->path);
+                free(c);
+                return NULL;
+        }
+
         return c;
 }
 
@@ -1670,7 +1682,7 @@ static int service_spawn(
         } else
                 unit_unwatch_timer(UNIT(s), &s->timer_watch);
 
-        if (!(argv = unit_full_printf_strv(UNIT(s), c->argv))) {
+        if (!(argv = unit_full_printf_template(UNIT(s), c->argv_template))) {
                 r = -ENOMEM;
                 goto fail;
         }
@@ -3201,6 +3213,34 @@ int service_set_socket_fd(Service *s, int fd, Socket *sock) {
         return 0;
 }
 
+int service_add_configured_socket(Service *s, Socket *sock) {
+        int r;
+
+        assert(s);
+        assert(sock);
+
+        /* Adds sock to the sockets configured for this service, and
+         * keeps the reverse index on the socket side in sync, so
+         * that the socket can find its services without iterating
+         * through all of them. */
+
+        if ((r = set_ensure_allocated(&s->configured_sockets, trivial_hash_func, trivial_compare_func)) < 0)
+                return r;
+
+        if ((r = set_ensure_allocated(&sock->configured_services, trivial_hash_func, trivial_compare_func)) < 0)
+                return r;
+
+        if ((r = set_put(s->configured_sockets, sock)) < 0)
+                return r;
+
+        if ((r = set_put(sock->configured_services, s)) < 0) {
+                set_remove(s->configured_sockets, sock);
+                return r;
+        }
+
+        return 0;
+}
+
 static void service_reset_failed(Unit *u) {
         Service *s = SERVICE(u);
 
@@ -3329,6 +3369,7 @@ DEFINE_STRING_TABLE_LOOKUP(notify_access, NotifyAccess);
 
 const UnitVTable service_vtable = {
         .suffix = ".service",
+        .object_size = sizeof(Service),
         .show_status = true,
 
         .init = service_init,
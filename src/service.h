@@ -163,6 +163,7 @@ struct Service {
 extern const UnitVTable service_vtable;
 
 int service_set_socket_fd(Service *s, int fd, struct Socket *socket);
+int service_add_configured_socket(Service *s, struct Socket *socket);
 
 const char* service_state_to_string(ServiceState i);
 ServiceState service_state_from_string(const char *s);
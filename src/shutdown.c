@@ -26,6 +26,7 @@
 #include <sys/wait.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <signal.h>
 #include <stdbool.h>
@@ -39,6 +40,11 @@
 #define TIMEOUT_USEC (5 * USEC_PER_SEC)
 #define FINALIZE_ATTEMPTS 50
 
+/* Not exported by the kernel headers */
+#ifndef PF_KTHREAD
+#define PF_KTHREAD 0x00200000
+#endif
+
 static bool ignore_proc(pid_t pid) {
         if (pid == 1)
                 return true;
@@ -48,21 +54,49 @@ static bool ignore_proc(pid_t pid) {
         return false;
 }
 
-static bool is_kernel_thread(pid_t pid)
-{
-        char buf[PATH_MAX];
-        FILE *f;
-        char c;
-        size_t count;
+static bool is_kernel_thread(int proc_fd, pid_t pid) {
+        char fn[32], buf[256], *p;
+        int fd;
+        ssize_t l;
+        char state;
+        unsigned flags;
+
+        /* Reads /proc/<pid>/stat once, relative to the already open
+         * /proc directory. Zombies are treated like kernel threads,
+         * since there is nothing left to kill. */
 
-        snprintf(buf, sizeof(buf), "/proc/%lu/cmdline", (unsigned long)pid);
-        f = fopen(buf, "re");
-        if (!f)
+        snprintf(fn, sizeof(fn), "%lu/stat", (unsigned long) pid);
+        char_array_0(fn);
+
+        if ((fd = openat(proc_fd, fn, O_RDONLY|O_CLOEXEC|O_NOCTTY)) < 0)
                 return true; /* not really, but has the desired effect */
 
-        count = fread(&c, 1, 1, f);
-        fclose(f);
-        return count != 1;
+        l = read(fd, buf, sizeof(buf) - 1);
+        close_nointr_nofail(fd);
+
+        if (l <= 0)
+                return true;
+
+        buf[l] = 0;
+
+        /* The process name might contain spaces and parentheses,
+         * hence look for the last ')' */
+        if (!(p = strrchr(buf, ')')))
+                return true;
+
+        if (sscanf(p + 1,
+                   " %c "      /* state */
+                   "%*d "      /* ppid */
+                   "%*d "      /* pgrp */
+                   "%*d "      /* session */
+                   "%*d "      /* tty_nr */
+                   "%*d "      /* tpgid */
+                   "%u",       /* flags */
+                   &state,
+                   &flags) != 2)
+                return true;
+
+        return state == 'Z' || (flags & PF_KTHREAD);
 }
 
 static int killall(int sign) {
@@ -79,7 +113,7 @@ static int killall(int sign) {
                 if (parse_pid(d->d_name, &pid) < 0)
                         continue;
 
-                if (is_kernel_thread(pid))
+                if (is_kernel_thread(dirfd(dir), pid))
                         continue;
 
                 if (ignore_proc(pid))
@@ -96,7 +130,8 @@ static int killall(int sign) {
         return n_processes;
 }
 
-static void wait_for_children(int n_processes, sigset_t *mask) {
+/* Returns how many of the n_processes we did not see terminate */
+static int wait_for_children(int n_processes, sigset_t *mask) {
         usec_t until;
 
         assert(mask);
@@ -113,17 +148,21 @@ static void wait_for_children(int n_processes, sigset_t *mask) {
                         if (pid == 0)
                                 break;
 
-                        if (pid < 0 && errno == ECHILD)
-                                return;
+                        if (pid < 0) {
+                                if (errno == EINTR)
+                                        continue;
+
+                                return 0;
+                        }
 
                         if (n_processes > 0)
                                 if (--n_processes == 0)
-                                        return;
+                                        return 0;
                 }
 
                 n = now(CLOCK_MONOTONIC);
                 if (n >= until)
-                        return;
+                        return n_processes;
 
                 timespec_store(&ts, until - n);
 
@@ -131,7 +170,7 @@ static void wait_for_children(int n_processes, sigset_t *mask) {
 
                         if (k < 0 && errno != EAGAIN) {
                                 log_error("sigtimedwait() failed: %m");
-                                return;
+                                return n_processes;
                         }
 
                         if (k >= 0)
@@ -142,12 +181,16 @@ static void wait_for_children(int n_processes, sigset_t *mask) {
 
 static void send_signal(int sign) {
         sigset_t mask, oldmask;
-        int n_processes;
+        int n_processes, n_left;
+        usec_t start;
+        char t[FORMAT_TIMESPAN_MAX];
 
         assert_se(sigemptyset(&mask) == 0);
         assert_se(sigaddset(&mask, SIGCHLD) == 0);
         assert_se(sigprocmask(SIG_BLOCK, &mask, &oldmask) == 0);
 
+        start = now(CLOCK_MONOTONIC);
+
         if (kill(-1, SIGSTOP) < 0 && errno != ESRCH)
                 log_warning("kill(-1, SIGSTOP) failed: %m");
 
@@ -159,7 +202,14 @@ static void send_signal(int sign) {
         if (n_processes <= 0)
                 goto finish;
 
-        wait_for_children(n_processes, &mask);
+        n_left = wait_for_children(n_processes, &mask);
+
+        format_timespan(t, sizeof(t), now(CLOCK_MONOTONIC) - start);
+
+        if (n_left > 0)
+                log_info("Sent %s to %i processes, %i still not terminated after %s.", signal_to_string(sign), n_processes, n_left, t);
+        else
+                log_info("Sent %s to %i processes, all terminated after %s.", signal_to_string(sign), n_processes, t);
 
 finish:
         sigprocmask(SIG_SETMASK, &oldmask, NULL);
@@ -192,6 +242,12 @@ finish:
         sigprocmask(SIG_SETMASK, &oldmask, NULL);
 }
 
+static void log_phase_done(const char *phase, usec_t start) {
+        char t[FORMAT_TIMESPAN_MAX];
+
+        log_info("%s took %s.", phase, format_timespan(t, sizeof(t), now(CLOCK_MONOTONIC) - start));
+}
+
 int main(int argc, char *argv[]) {
         int cmd, r;
         unsigned retries;
@@ -248,8 +304,12 @@ int main(int argc, char *argv[]) {
                 bool changed = false;
 
                 if (need_umount) {
+                        usec_t start = now(CLOCK_MONOTONIC);
+
                         log_info("Unmounting file systems.");
                         r = umount_all(&changed);
+                        log_phase_done("Unmounting file systems", start);
+
                         if (r == 0)
                                 need_umount = false;
                         else if (r > 0)
@@ -259,8 +319,12 @@ int main(int argc, char *argv[]) {
                 }
 
                 if (need_swapoff) {
+                        usec_t start = now(CLOCK_MONOTONIC);
+
                         log_info("Disabling swaps.");
                         r = swapoff_all(&changed);
+                        log_phase_done("Disabling swaps", start);
+
                         if (r == 0)
                                 need_swapoff = false;
                         else if (r > 0)
@@ -270,8 +334,12 @@ int main(int argc, char *argv[]) {
                 }
 
                 if (need_loop_detach) {
+                        usec_t start = now(CLOCK_MONOTONIC);
+
                         log_info("Detaching loop devices.");
                         r = loopback_detach_all(&changed);
+                        log_phase_done("Detaching loop devices", start);
+
                         if (r == 0)
                                 need_loop_detach = false;
                         else if (r > 0)
@@ -281,8 +349,12 @@ int main(int argc, char *argv[]) {
                 }
 
                 if (need_dm_detach) {
+                        usec_t start = now(CLOCK_MONOTONIC);
+
                         log_info("Detaching DM devices.");
                         r = dm_detach_all(&changed);
+                        log_phase_done("Detaching DM devices", start);
+
                         if (r == 0)
                                 need_dm_detach = false;
                         else if (r > 0)
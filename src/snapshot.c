@@ -282,6 +282,7 @@ DEFINE_STRING_TABLE_LOOKUP(snapshot_state, SnapshotState);
 
 const UnitVTable snapshot_vtable = {
         .suffix = ".snapshot",
+        .object_size = sizeof(Snapshot),
 
         .no_alias = true,
         .no_instances = true,
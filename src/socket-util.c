@@ -390,6 +390,7 @@ int socket_address_listen(
                 const char *bind_to_device,
                 bool free_bind,
                 bool transparent,
+                bool reuse_port,
                 mode_t directory_mode,
                 mode_t socket_mode,
                 const char *label,
@@ -440,6 +441,14 @@ int socket_address_listen(
                         if (setsockopt(fd, IPPROTO_IP, IP_TRANSPARENT, &one, sizeof(one)) < 0)
                                 log_warning("IP_TRANSPARENT failed: %m");
                 }
+
+                /* Without this we couldn't bind more than one
+                 * listener to the same address, hence fail */
+                if (reuse_port) {
+                        one = 1;
+                        if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0)
+                                goto fail;
+                }
         }
 
         one = 1;
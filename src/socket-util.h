@@ -79,6 +79,7 @@ int socket_address_listen(
                 const char *bind_to_device,
                 bool free_bind,
                 bool transparent,
+                bool reuse_port,
                 mode_t directory_mode,
                 mode_t socket_mode,
                 const char *label,
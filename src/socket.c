@@ -45,6 +45,10 @@
 #include "exit-status.h"
 #include "def.h"
 
+/* How many connections to accept on an Accept=yes socket per
+ * wakeup at most */
+#define ACCEPT_BATCH_MAX 64
+
 static const UnitActiveState state_translation_table[_SOCKET_STATE_MAX] = {
         [SOCKET_DEAD] = UNIT_INACTIVE,
         [SOCKET_START_PRE] = UNIT_ACTIVATING,
@@ -95,16 +99,40 @@ static void socket_unwatch_control_pid(Socket *s) {
         s->control_pid = 0;
 }
 
+static const char *socket_port_path(SocketPort *p) {
+        assert(p);
+
+        /* Returns the file system path of the port, if it has one */
+
+        if (p->type == SOCKET_SOCKET) {
+                if (socket_address_family(&p->address) != AF_UNIX ||
+                    p->address.sockaddr.un.sun_path[0] == 0)
+                        return NULL;
+
+                return p->address.sockaddr.un.sun_path;
+        }
+
+        if (p->type == SOCKET_FIFO || p->type == SOCKET_SPECIAL)
+                return p->path;
+
+        return NULL;
+}
+
 static void socket_done(Unit *u) {
         Socket *s = SOCKET(u);
         SocketPort *p;
+        Service *service;
         Meta *i;
+        const char *path;
 
         assert(s);
 
         while ((p = s->ports)) {
                 LIST_REMOVE(SocketPort, port, s->ports, p);
 
+                if ((path = socket_port_path(p)))
+                        mount_index_remove_unit(u, path);
+
                 if (p->fd >= 0) {
                         unit_unwatch_fd(UNIT(s), &p->fd_watch);
                         close_nointr_nofail(p->fd);
@@ -131,14 +159,15 @@ static void socket_done(Unit *u) {
         unit_unwatch_timer(u, &s->timer_watch);
 
         /* Make sure no service instance refers to us anymore. */
-        LIST_FOREACH(units_per_type, i, u->meta.manager->units_per_type[UNIT_SERVICE]) {
-                Service *service = (Service *) i;
-
-                if (service->accept_socket == s)
-                        service->accept_socket = NULL;
+        LIST_FOREACH(units_per_type, i, u->meta.manager->units_per_type[UNIT_SERVICE])
+                if (((Service*) i)->accept_socket == s)
+                        ((Service*) i)->accept_socket = NULL;
 
+        while ((service = set_steal_first(s->configured_services)))
                 set_remove(service->configured_sockets, s);
-        }
+
+        set_free(s->configured_services);
+        s->configured_services = NULL;
 }
 
 static int socket_instantiate_service(Socket *s) {
@@ -278,15 +307,32 @@ int socket_add_one_mount_link(Socket *s, Mount *m) {
 }
 
 static int socket_add_mount_links(Socket *s) {
-        Meta *other;
+        SocketPort *p;
         int r;
 
         assert(s);
 
-        LIST_FOREACH(units_per_type, other, s->meta.manager->units_per_type[UNIT_MOUNT])
-                if ((r = socket_add_one_mount_link(s, (Mount*) other)) < 0)
+        /* Only the mount points above our file system paths are
+         * relevant, hence look them up in the mount index. Mounts
+         * loaded later find us there, too. */
+
+        LIST_FOREACH(port, p, s->ports) {
+                const char *path;
+                MountNode *n;
+                Mount *m;
+
+                if (!(path = socket_port_path(p)))
+                        continue;
+
+                if ((r = mount_index_add_unit(UNIT(s), path)) < 0)
                         return r;
 
+                for (n = mount_node_root(s->meta.manager, path); n; n = mount_node_next(n, &path))
+                        LIST_FOREACH(by_where, m, n->by_where)
+                                if ((r = socket_add_one_mount_link(s, m)) < 0)
+                                        return r;
+        }
+
         return 0;
 }
 
@@ -323,6 +369,54 @@ static int socket_add_default_dependencies(Socket *s) {
         return unit_add_two_dependencies_by_name(UNIT(s), UNIT_BEFORE, UNIT_CONFLICTS, SPECIAL_SHUTDOWN_TARGET, NULL, true);
 }
 
+static bool socket_port_can_reuse(SocketPort *p) {
+        assert(p);
+
+        return
+                p->type == SOCKET_SOCKET &&
+                (socket_address_family(&p->address) == AF_INET ||
+                 socket_address_family(&p->address) == AF_INET6) &&
+                (p->address.type == SOCK_STREAM ||
+                 p->address.type == SOCK_DGRAM);
+}
+
+static int socket_add_reuse_port_listeners(Socket *s) {
+        SocketPort *p;
+
+        assert(s);
+
+        /* If requested, duplicate each IP port, so that we open
+         * multiple SO_REUSEPORT listeners for the same address,
+         * each with its own accept queue, which are passed as
+         * separate fds to the service. */
+
+        if (s->reuse_port_listeners <= 1)
+                return 0;
+
+        LIST_FOREACH(port, p, s->ports) {
+                unsigned i;
+
+                if (!socket_port_can_reuse(p))
+                        continue;
+
+                for (i = 1; i < s->reuse_port_listeners; i++) {
+                        SocketPort *n;
+
+                        if (!(n = new0(SocketPort, 1)))
+                                return -ENOMEM;
+
+                        n->type = p->type;
+                        n->fd = -1;
+                        n->address = p->address;
+
+                        LIST_INSERT_AFTER(SocketPort, port, s->ports, p, n);
+                        p = n;
+                }
+        }
+
+        return 0;
+}
+
 static int socket_load(Unit *u) {
         Socket *s = SOCKET(u);
         int r;
@@ -336,6 +430,9 @@ static int socket_load(Unit *u) {
         /* This is a new unit? Then let's add in some extras */
         if (u->meta.load_state == UNIT_LOADED) {
 
+                if ((r = socket_add_reuse_port_listeners(s)) < 0)
+                        return r;
+
                 if (have_non_accept_socket(s)) {
 
                         if (!s->service)
@@ -428,14 +525,23 @@ static void socket_dump(Unit *u, FILE *f, const char *prefix) {
                         "%sBindToDevice: %s\n",
                         prefix, s->bind_to_device);
 
+        if (s->reuse_port_listeners > 1)
+                fprintf(f,
+                        "%sReusePortListeners: %u\n",
+                        prefix, s->reuse_port_listeners);
+
         if (s->accept)
                 fprintf(f,
                         "%sAccepted: %u\n"
                         "%sNConnections: %u\n"
-                        "%sMaxConnections: %u\n",
+                        "%sMaxConnections: %u\n"
+                        "%sNRefused: %u\n"
+                        "%sNBacklogMax: %u\n",
                         prefix, s->n_accepted,
                         prefix, s->n_connections,
-                        prefix, s->max_connections);
+                        prefix, s->max_connections,
+                        prefix, s->n_refused,
+                        prefix, s->n_backlog_max);
 
         if (s->priority >= 0)
                 fprintf(f,
@@ -908,6 +1014,7 @@ static int socket_open_fds(Socket *s) {
                                              s->bind_to_device,
                                              s->free_bind,
                                              s->transparent,
+                                             s->reuse_port_listeners > 1,
                                              s->directory_mode,
                                              s->socket_mode,
                                              label,
@@ -1094,7 +1201,7 @@ static int socket_spawn(Socket *s, ExecCommand *c, pid_t *_pid) {
         if ((r = unit_watch_timer(UNIT(s), s->timeout_usec, &s->timer_watch)) < 0)
                 goto fail;
 
-        if (!(argv = unit_full_printf_strv(UNIT(s), c->argv))) {
+        if (!(argv = unit_full_printf_template(UNIT(s), c->argv_template))) {
                 r = -ENOMEM;
                 goto fail;
         }
@@ -1328,11 +1435,65 @@ fail:
         socket_enter_dead(s, false);
 }
 
-static void socket_enter_running(Socket *s, int cfd) {
+static int socket_prepare_connection(Socket *s, int cfd, Service **_service) {
+        char *prefix, *instance = NULL, *name;
+        Service *service;
+        int r;
+
+        assert(s);
+        assert(cfd >= 0);
+        assert(_service);
+
+        /* Sets up the per-connection service for cfd, and passes
+         * ownership of the fd to it on success. */
+
+        if ((r = socket_instantiate_service(s)) < 0)
+                return r;
+
+        if ((r = instance_from_socket(cfd, s->n_accepted, &instance)) < 0)
+                return r;
+
+        if (!(prefix = unit_name_to_prefix(s->meta.id))) {
+                free(instance);
+                return -ENOMEM;
+        }
+
+        name = unit_name_build(prefix, instance, ".service");
+        free(prefix);
+        free(instance);
+
+        if (!name)
+                return -ENOMEM;
+
+        if ((r = unit_add_name(UNIT(s->service), name)) < 0) {
+                free(name);
+                return r;
+        }
+
+        service = s->service;
+        s->service = NULL;
+        s->n_accepted ++;
+
+        service->meta.no_gc = false;
+
+        unit_choose_id(UNIT(service), name);
+        free(name);
+
+        if ((r = service_set_socket_fd(service, cfd, s)) < 0)
+                return r;
+
+        s->n_connections ++;
+
+        *_service = service;
+        return 0;
+}
+
+static void socket_enter_running(Socket *s, int cfds[], unsigned n_cfds) {
         int r;
         DBusError error;
 
         assert(s);
+        assert(cfds || n_cfds <= 0);
         dbus_error_init(&error);
 
         /* We don't take connections anymore if we are supposed to
@@ -1340,9 +1501,11 @@ static void socket_enter_running(Socket *s, int cfd) {
         if (unit_pending_inactive(UNIT(s))) {
                 log_debug("Suppressing connection request on %s since unit stop is scheduled.", s->meta.id);
 
-                if (cfd >= 0)
-                        close_nointr_nofail(cfd);
-                else  {
+                if (n_cfds > 0) {
+                        close_many(cfds, n_cfds);
+                        s->n_refused += n_cfds;
+                        unit_add_to_dbus_queue(UNIT(s));
+                } else  {
                         /* Flush all sockets by closing and reopening them */
                         socket_close_fds(s);
 
@@ -1355,24 +1518,18 @@ static void socket_enter_running(Socket *s, int cfd) {
                 return;
         }
 
-        if (cfd < 0) {
+        if (n_cfds <= 0) {
                 bool pending = false;
-                Meta *i;
+                Service *service;
+                Iterator k;
 
                 /* If there's already a start pending don't bother to
                  * do anything */
-                LIST_FOREACH(units_per_type, i, s->meta.manager->units_per_type[UNIT_SERVICE]) {
-                        Service *service = (Service *) i;
-
-                        if (!set_get(service->configured_sockets, s))
-                                continue;
-
-                        if (!unit_pending_active(UNIT(service)))
-                                continue;
-
-                        pending = true;
-                        break;
-                }
+                SET_FOREACH(service, s->configured_services, k)
+                        if (unit_pending_active(UNIT(service))) {
+                                pending = true;
+                                break;
+                        }
 
                 if (!pending)
                         if ((r = manager_add_job(s->meta.manager, JOB_START, UNIT(s->service), JOB_REPLACE, true, &error, NULL)) < 0)
@@ -1380,58 +1537,55 @@ static void socket_enter_running(Socket *s, int cfd) {
 
                 socket_set_state(s, SOCKET_RUNNING);
         } else {
-                char *prefix, *instance = NULL, *name;
-                Service *service;
+                Unit *services[ACCEPT_BATCH_MAX];
+                unsigned i, n_services = 0;
 
-                if (s->n_connections >= s->max_connections) {
-                        log_warning("Too many incoming connections (%u)", s->n_connections);
-                        close_nointr_nofail(cfd);
-                        return;
-                }
-
-                if ((r = socket_instantiate_service(s)) < 0)
-                        goto fail;
+                assert(n_cfds <= ACCEPT_BATCH_MAX);
 
-                if ((r = instance_from_socket(cfd, s->n_accepted, &instance)) < 0)
-                        goto fail;
+                /* Set up one service per connection first, and then
+                 * enqueue all of them in a single transaction. A
+                 * connection we cannot set up is refused on its own,
+                 * without affecting the others. */
 
-                if (!(prefix = unit_name_to_prefix(s->meta.id))) {
-                        free(instance);
-                        r = -ENOMEM;
-                        goto fail;
-                }
+                for (i = 0; i < n_cfds; i++) {
+                        Service *service;
 
-                name = unit_name_build(prefix, instance, ".service");
-                free(prefix);
-                free(instance);
+                        if (s->n_connections >= s->max_connections) {
+                                log_warning("Too many incoming connections (%u)", s->n_connections);
+                                close_nointr_nofail(cfds[i]);
+                                s->n_refused ++;
+                                continue;
+                        }
 
-                if (!name) {
-                        r = -ENOMEM;
-                        goto fail;
-                }
+                        if ((r = socket_prepare_connection(s, cfds[i], &service)) < 0) {
+                                log_warning("%s failed to set up service for incoming connection: %s", s->meta.id, strerror(-r));
+                                close_nointr_nofail(cfds[i]);
+                                s->n_refused ++;
+                                continue;
+                        }
 
-                if ((r = unit_add_name(UNIT(s->service), name)) < 0) {
-                        free(name);
-                        goto fail;
+                        services[n_services++] = UNIT(service);
                 }
 
-                service = s->service;
-                s->service = NULL;
-                s->n_accepted ++;
-
-                service->meta.no_gc = false;
+                if (manager_add_jobs(s->meta.manager, JOB_START, services, n_services, JOB_REPLACE, true, &error) < 0) {
 
-                unit_choose_id(UNIT(service), name);
-                free(name);
+                        /* A single conflicting instance fails the
+                         * whole transaction, hence retry one by one,
+                         * so that we only lose that connection */
+                        dbus_error_free(&error);
 
-                if ((r = service_set_socket_fd(service, cfd, s)) < 0)
-                        goto fail;
+                        for (i = 0; i < n_services; i++)
+                                if ((r = manager_add_job(s->meta.manager, JOB_START, services[i], JOB_REPLACE, true, &error, NULL)) < 0) {
+                                        log_warning("%s failed to queue service startup job: %s", services[i]->meta.id, bus_error(&error, r));
+                                        dbus_error_free(&error);
 
-                cfd = -1;
-                s->n_connections ++;
-
-                if ((r = manager_add_job(s->meta.manager, JOB_START, UNIT(service), JOB_REPLACE, true, &error, NULL)) < 0)
-                        goto fail;
+                                        /* The service still owns the
+                                         * connection, and closes it
+                                         * when it is collected */
+                                        unit_add_to_gc_queue(services[i]);
+                                        s->n_refused ++;
+                                }
+                }
 
                 /* Notify clients about changed counters */
                 unit_add_to_dbus_queue(UNIT(s));
@@ -1443,9 +1597,6 @@ fail:
         log_warning("%s failed to queue socket startup job: %s", s->meta.id, bus_error(&error, r));
         socket_enter_stop_pre(s, false);
 
-        if (cfd >= 0)
-                close_nointr_nofail(cfd);
-
         dbus_error_free(&error);
 }
 
@@ -1569,6 +1720,8 @@ static int socket_serialize(Unit *u, FILE *f, FDSet *fds) {
         unit_serialize_item(u, f, "state", socket_state_to_string(s->state));
         unit_serialize_item(u, f, "failure", yes_no(s->failure));
         unit_serialize_item_format(u, f, "n-accepted", "%u", s->n_accepted);
+        unit_serialize_item_format(u, f, "n-refused", "%u", s->n_refused);
+        unit_serialize_item_format(u, f, "n-backlog-max", "%u", s->n_backlog_max);
 
         if (s->control_pid > 0)
                 unit_serialize_item_format(u, f, "control-pid", "%lu", (unsigned long) s->control_pid);
@@ -1637,6 +1790,20 @@ static int socket_deserialize_item(Unit *u, const char *key, const char *value,
                         log_debug("Failed to parse n-accepted value %s", value);
                 else
                         s->n_accepted += k;
+        } else if (streq(key, "n-refused")) {
+                unsigned k;
+
+                if (safe_atou(value, &k) < 0)
+                        log_debug("Failed to parse n-refused value %s", value);
+                else
+                        s->n_refused += k;
+        } else if (streq(key, "n-backlog-max")) {
+                unsigned k;
+
+                if (safe_atou(value, &k) < 0)
+                        log_debug("Failed to parse n-backlog-max value %s", value);
+                else
+                        s->n_backlog_max = MAX(s->n_backlog_max, k);
         } else if (streq(key, "control-pid")) {
                 pid_t pid;
 
@@ -1695,17 +1862,27 @@ static int socket_deserialize_item(Unit *u, const char *key, const char *value,
 
         } else if (streq(key, "socket")) {
                 int fd, type, skip = 0;
-                SocketPort *p;
+                SocketPort *p, *found = NULL;
 
                 if (sscanf(value, "%i %i %n", &fd, &type, &skip) < 2 || fd < 0 || type < 0 || !fdset_contains(fds, fd))
                         log_debug("Failed to parse socket value %s", value);
                 else {
 
+                        /* With ReusePortListeners= the same address
+                         * shows up multiple times, so fill in the
+                         * ports that have no fd yet first. */
                         LIST_FOREACH(port, p, s->ports)
-                                if (socket_address_is(&p->address, value+skip, type))
-                                        break;
+                                if (socket_address_is(&p->address, value+skip, type)) {
+                                        if (!found)
+                                                found = p;
 
-                        if (p) {
+                                        if (p->fd < 0) {
+                                                found = p;
+                                                break;
+                                        }
+                                }
+
+                        if ((p = found)) {
                                 if (p->fd >= 0)
                                         close_nointr_nofail(p->fd);
                                 p->fd = fdset_remove(fds, fd);
@@ -1759,7 +1936,8 @@ static bool socket_check_gc(Unit *u) {
 
 static void socket_fd_event(Unit *u, int fd, uint32_t events, Watch *w) {
         Socket *s = SOCKET(u);
-        int cfd = -1;
+        int cfds[ACCEPT_BATCH_MAX];
+        unsigned n_cfds = 0;
 
         assert(s);
         assert(fd >= 0);
@@ -1780,24 +1958,45 @@ static void socket_fd_event(Unit *u, int fd, uint32_t events, Watch *w) {
         }
 
         if (w->socket_accept) {
-                for (;;) {
+
+                /* Drain as many pending connections as we can in
+                 * one go, so that bursts of clients don't cost us
+                 * one loop iteration each. */
+
+                while (n_cfds < ACCEPT_BATCH_MAX) {
+                        int cfd;
 
                         if ((cfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK)) < 0) {
 
                                 if (errno == EINTR)
                                         continue;
 
+                                if (n_cfds > 0) {
+                                        /* Hand over what we got so
+                                         * far, and let the next
+                                         * wakeup deal with the
+                                         * error, if it persists */
+                                        if (errno != EAGAIN)
+                                                log_warning("%s: Failed to accept further connections: %m", u->meta.id);
+
+                                        break;
+                                }
+
                                 log_error("Failed to accept socket: %m");
                                 goto fail;
                         }
 
-                        break;
+                        socket_apply_socket_options(s, cfd);
+                        cfds[n_cfds++] = cfd;
                 }
 
-                socket_apply_socket_options(s, cfd);
+                if (n_cfds > s->n_backlog_max) {
+                        s->n_backlog_max = n_cfds;
+                        unit_add_to_dbus_queue(UNIT(s));
+                }
         }
 
-        socket_enter_running(s, cfd);
+        socket_enter_running(s, cfds, n_cfds);
         return;
 
 fail:
@@ -2087,6 +2286,7 @@ DEFINE_STRING_TABLE_LOOKUP(socket_exec_command, SocketExecCommand);
 
 const UnitVTable socket_vtable = {
         .suffix = ".socket",
+        .object_size = sizeof(Socket),
 
         .init = socket_init,
         .done = socket_done,
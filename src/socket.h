@@ -84,6 +84,11 @@ struct Socket {
         unsigned n_connections;
         unsigned max_connections;
 
+        /* Connections we closed right away, and the largest number
+         * of connections found queued on a single wakeup */
+        unsigned n_refused;
+        unsigned n_backlog_max;
+
         unsigned backlog;
         usec_t timeout_usec;
 
@@ -95,6 +100,10 @@ struct Socket {
         when the next service we spawn. */
         Service *service;
 
+        /* The services that list us in Sockets=, i.e. the reverse
+         * of Service.configured_sockets */
+        Set *configured_services;
+
         SocketState state, deserialized_state;
 
         Watch timer_watch;
@@ -117,6 +126,7 @@ struct Socket {
         bool keep_alive;
         bool free_bind;
         bool transparent;
+        unsigned reuse_port_listeners;
         bool broadcast;
         int priority;
         int mark;
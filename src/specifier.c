@@ -23,6 +23,7 @@
 
 #include "macro.h"
 #include "util.h"
+#include "strv.h"
 #include "specifier.h"
 
 /*
@@ -31,73 +32,257 @@
  *
  */
 
-char *specifier_printf(const char *text, const Specifier table[], void *userdata) {
-        char *r, *t;
+typedef struct SpecifierPart {
+        unsigned arg;
+        char specifier;          /* 0 for literal text */
+        const char *literal;
+        size_t length;
+} SpecifierPart;
+
+struct SpecifierTemplate {
+        unsigned n_args;
+        unsigned n_parts;
+        SpecifierPart *parts;
+};
+
+static void compile_one(const char *text, unsigned arg, SpecifierPart *parts, char *buffer, unsigned *n_parts, size_t *n_buffer) {
         const char *f;
-        bool percent = false;
-        size_t l;
+        bool percent = false, in_literal = false;
+
+        /* Splits a single string into literal runs and specifier
+         * references. If parts is NULL this only counts how much
+         * space is needed. */
+
+        for (f = text; *f; f++) {
+
+                if (percent) {
+                        percent = false;
+
+                        if (*f != '%') {
+                                if (parts) {
+                                        parts[*n_parts].arg = arg;
+                                        parts[*n_parts].specifier = *f;
+                                        parts[*n_parts].literal = NULL;
+                                        parts[*n_parts].length = 0;
+                                }
+
+                                (*n_parts)++;
+                                in_literal = false;
+                                continue;
+                        }
+
+                } else if (*f == '%') {
+                        percent = true;
+                        continue;
+                }
+
+                if (!in_literal) {
+                        if (parts) {
+                                parts[*n_parts].arg = arg;
+                                parts[*n_parts].specifier = 0;
+                                parts[*n_parts].literal = buffer + *n_buffer;
+                                parts[*n_parts].length = 0;
+                        }
+
+                        (*n_parts)++;
+                        in_literal = true;
+                }
+
+                if (parts) {
+                        buffer[*n_buffer] = *f;
+                        parts[*n_parts - 1].length++;
+                }
+
+                (*n_buffer)++;
+        }
+}
+
+SpecifierTemplate *specifier_template_new_strv(char **l) {
+        SpecifierTemplate *t;
+        unsigned n_args = 0, n_parts = 0;
+        size_t n_buffer = 0;
+        char **i;
+        char *buffer;
+
+        /* Compiles a list of strings into a single template, so that
+         * the format strings do not need to be rescanned on each
+         * expansion. Everything is placed in one allocation. */
+
+        STRV_FOREACH(i, l) {
+                compile_one(*i, n_args, NULL, NULL, &n_parts, &n_buffer);
+                n_args++;
+        }
+
+        if (!(t = malloc(ALIGN(sizeof(SpecifierTemplate)) + sizeof(SpecifierPart) * n_parts + n_buffer)))
+                return NULL;
+
+        t->n_args = n_args;
+        t->parts = (SpecifierPart*) ((uint8_t*) t + ALIGN(sizeof(SpecifierTemplate)));
+        buffer = (char*) (t->parts + n_parts);
+
+        n_args = n_parts = 0;
+        n_buffer = 0;
+
+        STRV_FOREACH(i, l) {
+                compile_one(*i, n_args, t->parts, buffer, &n_parts, &n_buffer);
+                n_args++;
+        }
+
+        t->n_parts = n_parts;
+        return t;
+}
+
+SpecifierTemplate *specifier_template_new(const char *text) {
+        char *l[2] = { (char*) text, NULL };
 
         assert(text);
+
+        return specifier_template_new_strv(l);
+}
+
+void specifier_template_free(SpecifierTemplate *t) {
+        free(t);
+}
+
+static const Specifier *specifier_find(const Specifier table[], char specifier) {
+        const Specifier *i;
+
+        for (i = table; i->specifier; i++)
+                if (i->specifier == specifier)
+                        return i;
+
+        return NULL;
+}
+
+char **specifier_template_expand_strv(const SpecifierTemplate *t, const Specifier table[], void *userdata) {
+        char **values = NULL, **r = NULL;
+        size_t *lengths = NULL;
+        unsigned n_table = 0, a, k, j;
+        const SpecifierPart *p;
+
+        assert(t);
         assert(table);
 
-        l = strlen(text);
-        if (!(r = new(char, l+1)))
-                return NULL;
+        while (table[n_table].specifier)
+                n_table++;
 
-        t = r;
+        /* Each specifier is looked up at most once per expansion,
+         * regardless how often it is referenced. */
 
-        for (f = text; *f; f++, l--) {
+        if (n_table > 0) {
+                if (!(values = new0(char*, n_table)) ||
+                    !(lengths = new(size_t, n_table)))
+                        goto fail;
+        }
 
-                if (percent) {
-                        if (*f == '%')
-                                *(t++) = '%';
-                        else {
-                                const Specifier *i;
+        for (p = t->parts; p < t->parts + t->n_parts; p++) {
+                const Specifier *i;
 
-                                for (i = table; i->specifier; i++)
-                                        if (i->specifier == *f)
-                                                break;
+                if (!p->specifier)
+                        continue;
 
-                                if (i->lookup) {
-                                        char *n, *w;
-                                        size_t k, j;
+                if (!(i = specifier_find(table, p->specifier)) || !i->lookup)
+                        continue;
 
-                                        if (!(w = i->lookup(i->specifier, i->data, userdata))) {
-                                                free(r);
-                                                return NULL;
-                                        }
+                k = i - table;
+                if (values[k])
+                        continue;
 
-                                        j = t - r;
-                                        k = strlen(w);
+                if (!(values[k] = i->lookup(i->specifier, i->data, userdata)))
+                        goto fail;
 
-                                        if (!(n = new(char, j + k + l + 1))) {
-                                                free(r);
-                                                free(w);
-                                                return NULL;
-                                        }
+                lengths[k] = strlen(values[k]);
+        }
 
-                                        memcpy(n, r, j);
-                                        memcpy(n + j, w, k);
+        if (!(r = new0(char*, t->n_args + 1)))
+                goto fail;
 
-                                        free(r);
-                                        free(w);
+        for (a = 0, p = t->parts; a < t->n_args; a++) {
+                const SpecifierPart *first = p;
+                size_t n = 0;
+                char *e;
 
-                                        r = n;
-                                        t = n + j + k;
-                                } else {
-                                        *(t++) = '%';
-                                        *(t++) = *f;
-                                }
+                /* First determine the size of this argument, then
+                 * fill it in with a single allocation */
+
+                for (; p < t->parts + t->n_parts && p->arg == a; p++) {
+                        const Specifier *i;
+
+                        if (!p->specifier)
+                                n += p->length;
+                        else if ((i = specifier_find(table, p->specifier)) && i->lookup)
+                                n += lengths[i - table];
+                        else
+                                n += 2;
+                }
+
+                if (!(r[a] = new(char, n + 1)))
+                        goto fail;
+
+                for (e = r[a]; first < p; first++) {
+                        const Specifier *i;
+
+                        if (!first->specifier)
+                                e = mempcpy(e, first->literal, first->length);
+                        else if ((i = specifier_find(table, first->specifier)) && i->lookup)
+                                e = mempcpy(e, values[i - table], lengths[i - table]);
+                        else {
+                                *(e++) = '%';
+                                *(e++) = first->specifier;
                         }
+                }
 
-                        percent = false;
-                } else if (*f == '%')
-                        percent = true;
-                else
-                        *(t++) = *f;
+                *e = 0;
         }
 
-        *t = 0;
+        for (j = 0; j < n_table; j++)
+                free(values[j]);
+        free(values);
+        free(lengths);
+
+        return r;
+
+fail:
+        if (values) {
+                for (j = 0; j < n_table; j++)
+                        free(values[j]);
+                free(values);
+        }
+
+        free(lengths);
+        strv_free(r);
+
+        return NULL;
+}
+
+char *specifier_template_expand(const SpecifierTemplate *t, const Specifier table[], void *userdata) {
+        char **l, *r;
+
+        assert(t);
+        assert(t->n_args == 1);
+
+        if (!(l = specifier_template_expand_strv(t, table, userdata)))
+                return NULL;
+
+        r = l[0];
+        free(l);
+
+        return r;
+}
+
+char *specifier_printf(const char *text, const Specifier table[], void *userdata) {
+        SpecifierTemplate *t;
+        char *r;
+
+        assert(text);
+        assert(table);
+
+        if (!(t = specifier_template_new(text)))
+                return NULL;
+
+        r = specifier_template_expand(t, table, userdata);
+        specifier_template_free(t);
+
         return r;
 }
 
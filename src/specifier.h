@@ -30,8 +30,17 @@ typedef struct Specifier {
         void *data;
 } Specifier;
 
+typedef struct SpecifierTemplate SpecifierTemplate;
+
 char *specifier_printf(const char *text, const Specifier table[], void *userdata);
 
+SpecifierTemplate *specifier_template_new(const char *text);
+SpecifierTemplate *specifier_template_new_strv(char **l);
+void specifier_template_free(SpecifierTemplate *t);
+
+char *specifier_template_expand(const SpecifierTemplate *t, const Specifier table[], void *userdata);
+char **specifier_template_expand_strv(const SpecifierTemplate *t, const Specifier table[], void *userdata);
+
 char* specifier_string(char specifier, void *data, void *userdata);
 
 #endif
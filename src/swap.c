@@ -51,24 +51,126 @@ static const UnitActiveState state_translation_table[_SWAP_STATE_MAX] = {
         [SWAP_FAILED] = UNIT_FAILED
 };
 
+static void swap_group_update_master(SwapGroup *g) {
+        unsigned i;
+
+        assert(g);
+        assert(g->n_units > 0);
+
+        /* Make everybody follow the unit that's named after the swap
+         * device in the kernel, or if there is none, the one added
+         * last */
+
+        for (i = 0; i < g->n_units; i++) {
+                Swap *s = SWAP(g->units[i]);
+
+                if (streq_ptr(s->what, s->parameters_proc_swaps.what)) {
+                        g->master = g->units[i];
+                        return;
+                }
+        }
+
+        g->master = g->units[g->n_units-1];
+}
+
+static void swap_group_free(Manager *m, SwapGroup *g) {
+        assert(m);
+        assert(g);
+        assert(g->n_units == 0);
+
+        hashmap_remove(m->swaps_by_proc_swaps, g->what);
+
+        free(g->units);
+        free(g->what);
+        free(g);
+}
+
+static int swap_set_proc_swaps(Swap *s, const char *what) {
+        Manager *m;
+        SwapGroup *g;
+        Unit **a;
+        int r;
+
+        assert(s);
+        assert(what);
+        assert(!s->parameters_proc_swaps.what);
+
+        /* Add this unit to the group of swaps which share the same
+         * kernel swap device. */
+
+        m = s->meta.manager;
+
+        if (!m->swaps_by_proc_swaps)
+                if (!(m->swaps_by_proc_swaps = hashmap_new(string_hash_func, string_compare_func)))
+                        return -ENOMEM;
+
+        if (!(g = hashmap_get(m->swaps_by_proc_swaps, what))) {
+
+                if (!(g = new0(SwapGroup, 1)))
+                        return -ENOMEM;
+
+                if (!(g->what = strdup(what))) {
+                        free(g);
+                        return -ENOMEM;
+                }
+
+                if ((r = hashmap_put(m->swaps_by_proc_swaps, g->what, g)) < 0) {
+                        free(g->what);
+                        free(g);
+                        return r;
+                }
+        }
+
+        if (!(s->parameters_proc_swaps.what = strdup(what)))
+                goto fail;
+
+        if (!(a = realloc(g->units, sizeof(Unit*) * (g->n_units + 1))))
+                goto fail;
+
+        g->units = a;
+        g->units[g->n_units++] = UNIT(s);
+        s->group = g;
+
+        swap_group_update_master(g);
+        return 0;
+
+fail:
+        free(s->parameters_proc_swaps.what);
+        s->parameters_proc_swaps.what = NULL;
+
+        if (g->n_units == 0)
+                swap_group_free(m, g);
+
+        return -ENOMEM;
+}
+
 static void swap_unset_proc_swaps(Swap *s) {
-        Swap *first;
+        SwapGroup *g;
+        unsigned i;
 
         assert(s);
 
         if (!s->parameters_proc_swaps.what)
                 return;
 
-        /* Remove this unit from the chain of swaps which share the
+        /* Remove this unit from the group of swaps which share the
          * same kernel swap device. */
 
-        first = hashmap_get(s->meta.manager->swaps_by_proc_swaps, s->parameters_proc_swaps.what);
-        LIST_REMOVE(Swap, same_proc_swaps, first, s);
+        g = s->group;
+        assert(g);
+
+        for (i = 0; g->units[i] != UNIT(s); i++)
+                assert(i < g->n_units);
 
-        if (first)
-                hashmap_remove_and_replace(s->meta.manager->swaps_by_proc_swaps, s->parameters_proc_swaps.what, first->parameters_proc_swaps.what, first);
+        memmove(g->units + i, g->units + i + 1, sizeof(Unit*) * (g->n_units - i - 1));
+        g->n_units--;
+
+        if (g->n_units > 0)
+                swap_group_update_master(g);
         else
-                hashmap_remove(s->meta.manager->swaps_by_proc_swaps, s->parameters_proc_swaps.what);
+                swap_group_free(s->meta.manager, g);
+
+        s->group = NULL;
 
         free(s->parameters_proc_swaps.what);
         s->parameters_proc_swaps.what = NULL;
@@ -111,6 +213,9 @@ static void swap_done(Unit *u) {
 
         swap_unset_proc_swaps(s);
 
+        if (s->what && !is_device_path(s->what))
+                mount_index_remove_unit(u, s->what);
+
         free(s->what);
         s->what = NULL;
 
@@ -150,14 +255,28 @@ int swap_add_one_mount_link(Swap *s, Mount *m) {
 }
 
 static int swap_add_mount_links(Swap *s) {
-        Meta *other;
+        const char *path;
+        MountNode *n;
+        Mount *m;
         int r;
 
         assert(s);
 
-        LIST_FOREACH(units_per_type, other, s->meta.manager->units_per_type[UNIT_MOUNT])
-                if ((r = swap_add_one_mount_link(s, (Mount*) other)) < 0)
-                        return r;
+        if (is_device_path(s->what))
+                return 0;
+
+        /* Only the mount points above our swap file are relevant,
+         * hence look them up in the mount index. Mounts loaded later
+         * find us there, too. */
+
+        if ((r = mount_index_add_unit(UNIT(s), s->what)) < 0)
+                return r;
+
+        path = s->what;
+        for (n = mount_node_root(s->meta.manager, path); n; n = mount_node_next(n, &path))
+                LIST_FOREACH(by_where, m, n->by_where)
+                        if ((r = swap_add_one_mount_link(s, m)) < 0)
+                                return r;
 
         return 0;
 }
@@ -290,6 +409,11 @@ static int swap_load(Unit *u) {
 
                 path_kill_slashes(s->what);
 
+                /* The master of our group might change now that we
+                 * know our final device path */
+                if (s->group)
+                        swap_group_update_master(s->group);
+
                 if (!s->meta.description)
                         if ((r = unit_set_description(u, s->what)) < 0)
                                 return r;
@@ -347,7 +471,7 @@ int swap_add_one(
         if (!u) {
                 delete = true;
 
-                if (!(u = unit_new(m))) {
+                if (!(u = unit_new(m, sizeof(Swap)))) {
                         free(e);
                         return -ENOMEM;
                 }
@@ -365,31 +489,11 @@ int swap_add_one(
                 delete = false;
 
         if (what_proc_swaps) {
-                Swap *first;
-
                 p = &SWAP(u)->parameters_proc_swaps;
 
-                if (!p->what) {
-                        if (!(wp = strdup(what_proc_swaps))) {
-                                r = -ENOMEM;
-                                goto fail;
-                        }
-
-                        if (!m->swaps_by_proc_swaps)
-                                if (!(m->swaps_by_proc_swaps = hashmap_new(string_hash_func, string_compare_func))) {
-                                        r = -ENOMEM;
-                                        goto fail;
-                                }
-
-                        free(p->what);
-                        p->what = wp;
-
-                        first = hashmap_get(m->swaps_by_proc_swaps, wp);
-                        LIST_PREPEND(Swap, same_proc_swaps, first, SWAP(u));
-
-                        if ((r = hashmap_replace(m->swaps_by_proc_swaps, wp, first)) < 0)
+                if (!p->what)
+                        if ((r = swap_set_proc_swaps(SWAP(u), what_proc_swaps)) < 0)
                                 goto fail;
-                }
 
                 if (set_flags) {
                         SWAP(u)->is_active = true;
@@ -1161,61 +1265,31 @@ int swap_fd_event(Manager *m, int events) {
 
 static Unit *swap_following(Unit *u) {
         Swap *s = SWAP(u);
-        Swap *other, *first = NULL;
 
         assert(s);
 
-        if (streq_ptr(s->what, s->parameters_proc_swaps.what))
+        if (!s->group || s->group->master == u)
                 return NULL;
 
-        /* Make everybody follow the unit that's named after the swap
-         * device in the kernel */
-
-        LIST_FOREACH_AFTER(same_proc_swaps, other, s)
-                if (streq_ptr(other->what, other->parameters_proc_swaps.what))
-                        return UNIT(other);
-
-        LIST_FOREACH_BEFORE(same_proc_swaps, other, s) {
-                if (streq_ptr(other->what, other->parameters_proc_swaps.what))
-                        return UNIT(other);
-
-                first = other;
-        }
-
-        return UNIT(first);
+        return s->group->master;
 }
 
-static int swap_following_set(Unit *u, Set **_set) {
+static int swap_following_set(Unit *u, Unit ***units, unsigned *n) {
         Swap *s = SWAP(u);
-        Swap *other;
-        Set *set;
-        int r;
 
         assert(s);
-        assert(_set);
+        assert(units);
+        assert(n);
 
-        if (LIST_JUST_US(same_proc_swaps, s)) {
-                *_set = NULL;
+        if (!s->group || s->group->n_units <= 1) {
+                *units = NULL;
+                *n = 0;
                 return 0;
         }
 
-        if (!(set = set_new(NULL, NULL)))
-                return -ENOMEM;
-
-        LIST_FOREACH_AFTER(same_proc_swaps, other, s)
-                if ((r = set_put(set, other)) < 0)
-                        goto fail;
-
-        LIST_FOREACH_BEFORE(same_proc_swaps, other, s)
-                if ((r = set_put(set, other)) < 0)
-                        goto fail;
-
-        *_set = set;
+        *units = s->group->units;
+        *n = s->group->n_units;
         return 1;
-
-fail:
-        set_free(set);
-        return r;
 }
 
 static void swap_shutdown(Manager *m) {
@@ -1338,6 +1412,7 @@ DEFINE_STRING_TABLE_LOOKUP(swap_exec_command, SwapExecCommand);
 
 const UnitVTable swap_vtable = {
         .suffix = ".swap",
+        .object_size = sizeof(Swap),
 
         .no_alias = true,
         .no_instances = true,
@@ -24,6 +24,7 @@
 ***/
 
 typedef struct Swap Swap;
+typedef struct SwapGroup SwapGroup;
 
 #include "unit.h"
 
@@ -91,9 +92,21 @@ struct Swap {
 
         /* In order to be able to distinguish dependencies on
         different device nodes we might end up creating multiple
-        devices for the same swap. We chain them up here. */
+        devices for the same swap. We group them up here. */
 
-        LIST_FIELDS(struct Swap, same_proc_swaps);
+        SwapGroup *group;
+};
+
+/* All swap units of the same kernel swap device, see
+ * Manager::swaps_by_proc_swaps. One of them is the master, which all
+ * others follow. */
+struct SwapGroup {
+        char *what;
+
+        Unit **units;
+        unsigned n_units;
+
+        Unit *master;
 };
 
 extern const UnitVTable swap_vtable;
@@ -1843,8 +1843,14 @@ typedef struct UnitStatusInfo {
         usec_t condition_timestamp;
         bool condition_result;
 
+        /* Resource usage, (uint64_t) -1 resp. (unsigned) -1 if unknown */
+        uint64_t cpu_usage;
+        uint64_t memory_usage;
+        unsigned n_tasks;
+
         /* Socket */
         unsigned n_accepted;
+        unsigned n_refused;
         unsigned n_connections;
         bool accept;
 
@@ -1952,7 +1958,7 @@ static void print_status_info(UnitStatusInfo *i) {
                 printf("\t    What: %s\n", i->what);
 
         if (i->accept)
-                printf("\tAccepted: %u; Connected: %u\n", i->n_accepted, i->n_connections);
+                printf("\tAccepted: %u; Connected: %u; Refused: %u\n", i->n_accepted, i->n_connections, i->n_refused);
 
         LIST_FOREACH(exec, p, i->exec) {
                 char *t;
@@ -2080,6 +2086,32 @@ static void print_status_info(UnitStatusInfo *i) {
                 }
         }
 
+        if (i->n_tasks != (unsigned) -1 ||
+            i->cpu_usage != (uint64_t) -1 ||
+            i->memory_usage != (uint64_t) -1) {
+                char timespan[FORMAT_TIMESPAN_MAX];
+                bool first = true;
+
+                printf("\t   Usage:");
+
+                if (i->n_tasks != (unsigned) -1) {
+                        printf(" Tasks: %u", i->n_tasks);
+                        first = false;
+                }
+
+                if (i->cpu_usage != (uint64_t) -1) {
+                        printf("%s CPU: %s", first ? "" : ";",
+                               strna(format_timespan(timespan, sizeof(timespan), i->cpu_usage / NSEC_PER_USEC)));
+                        first = false;
+                }
+
+                if (i->memory_usage != (uint64_t) -1)
+                        printf("%s Memory: %lluK", first ? "" : ";",
+                               (unsigned long long) (i->memory_usage / 1024));
+
+                printf("\n");
+        }
+
         if (i->need_daemon_reload)
                 printf("\n%sWarning:%s Unit file changed on disk, 'systemctl %s daemon-reload' recommended.\n",
                        ansi_highlight(true),
@@ -2166,6 +2198,10 @@ static int status_property(const char *name, DBusMessageIter *iter, UnitStatusIn
                         i->n_accepted = u;
                 else if (streq(name, "NConnections"))
                         i->n_connections = u;
+                else if (streq(name, "NRefused"))
+                        i->n_refused = u;
+                else if (streq(name, "ControlGroupTasks"))
+                        i->n_tasks = u;
 
                 break;
         }
@@ -2190,6 +2226,10 @@ static int status_property(const char *name, DBusMessageIter *iter, UnitStatusIn
 
                 if (streq(name, "ExecMainStartTimestamp"))
                         i->start_timestamp = (usec_t) u;
+                else if (streq(name, "ControlGroupCPUUsageNSec"))
+                        i->cpu_usage = u;
+                else if (streq(name, "ControlGroupMemoryUsage"))
+                        i->memory_usage = u;
                 else if (streq(name, "ExecMainExitTimestamp"))
                         i->exit_timestamp = (usec_t) u;
                 else if (streq(name, "ActiveEnterTimestamp"))
@@ -2527,6 +2567,8 @@ static int show_one(const char *verb, DBusConnection *bus, const char *path, boo
         assert(new_line);
 
         zero(info);
+        info.cpu_usage = info.memory_usage = (uint64_t) -1;
+        info.n_tasks = (unsigned) -1;
         dbus_error_init(&error);
 
         if (!(m = dbus_message_new_method_call(
@@ -22,6 +22,7 @@
 #include <string.h>
 
 #include "util.h"
+#include "strv.h"
 #include "specifier.h"
 
 int main(int argc, char *argv[]) {
@@ -31,7 +32,8 @@ int main(int argc, char *argv[]) {
                 { 0, NULL, NULL }
         };
 
-        char *w, *state;
+        char *w, *state, **a, *in[] = { (char*) "%a", (char*) "", (char*) "x%%y%z%b%", NULL };
+        SpecifierTemplate *tmpl;
         size_t l;
         const char test[] = "test a b c 'd' e '' '' hhh '' ''";
 
@@ -62,5 +64,14 @@ int main(int argc, char *argv[]) {
         printf("<%s>\n", w);
         free(w);
 
+        assert_se(tmpl = specifier_template_new_strv(in));
+        assert_se(a = specifier_template_expand_strv(tmpl, table, NULL));
+        assert_se(streq(a[0], "AAAA"));
+        assert_se(streq(a[1], ""));
+        assert_se(streq(a[2], "x%y%zBBBB"));
+        assert_se(!a[3]);
+        strv_free(a);
+        specifier_template_free(tmpl);
+
         return 0;
 }
@@ -24,6 +24,7 @@
 #include <string.h>
 #include <sys/mount.h>
 #include <sys/swap.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include <linux/loop.h>
 #include <linux/dm-ioctl.h>
@@ -31,13 +32,32 @@
 
 #include "list.h"
 #include "mount-setup.h"
+#include "mount-table.h"
 #include "umount.h"
 #include "util.h"
 
+/* How many unmount/detach operations to run at the same time */
+#define MOUNT_POINT_WORKERS_MAX 16
+
+/* Exit code of a worker process that succeeded without changing
+ * anything */
+#define MOUNT_POINT_EXIT_UNCHANGED 2
+
 typedef struct MountPoint {
         char *path;
         dev_t devnum;
         bool skip_ro;
+
+        /* The mount tree, only set up for mount points. A mount
+         * point is only unmounted after all its children have
+         * been. */
+        struct MountPoint *parent;
+        unsigned n_children;
+        unsigned depth;
+
+        pid_t worker;
+        bool failed;
+
         LIST_FIELDS (struct MountPoint, mount_point);
 } MountPoint;
 
@@ -59,81 +79,71 @@ static void mount_points_list_free(MountPoint **head) {
 }
 
 static int mount_points_list_get(MountPoint **head) {
-        FILE *proc_self_mountinfo;
-        char *path, *p;
-        unsigned int i;
+        MountTable *t;
+        MountTableEntry *e;
+        MountPoint **points = NULL, *m, *p;
         int r;
 
         assert(head);
 
-        if (!(proc_self_mountinfo = fopen("/proc/self/mountinfo", "re")))
-                return -errno;
+        if (!(t = mount_table_new()))
+                return -ENOMEM;
 
-        for (i = 1;; i++) {
-                int k;
-                MountPoint *m;
-                char *root;
-                bool skip_ro;
-
-                path = p = NULL;
-
-                if ((k = fscanf(proc_self_mountinfo,
-                                "%*s "       /* (1) mount id */
-                                "%*s "       /* (2) parent id */
-                                "%*s "       /* (3) major:minor */
-                                "%ms "       /* (4) root */
-                                "%ms "       /* (5) mount point */
-                                "%*s"        /* (6) mount options */
-                                "%*[^-]"     /* (7) optional fields */
-                                "- "         /* (8) separator */
-                                "%*s "       /* (9) file system type */
-                                "%*s"        /* (10) mount source */
-                                "%*s"        /* (11) mount options 2 */
-                                "%*[^\n]",   /* some rubbish at the end */
-                                &root,
-                                &path)) != 2) {
-                        if (k == EOF)
-                                break;
-
-                        log_warning("Failed to parse /proc/self/mountinfo:%u.", i);
+        if ((r = mount_table_load(t, -1)) < 0)
+                goto finish;
 
-                        free(path);
-                        continue;
-                }
+        if (t->n_entries > 0 &&
+            !(points = new0(MountPoint*, t->n_entries))) {
+                r = -ENOMEM;
+                goto finish;
+        }
 
-                /* If we encounter a bind mount, don't try to remount
-                 * the source dir too early */
-                skip_ro = !streq(root, "/");
-                free(root);
+        MOUNT_TABLE_FOREACH(e, t) {
 
-                p = cunescape(path);
-                free(path);
+                if (mount_point_is_api(e->path) || mount_point_ignore(e->path))
+                        continue;
 
-                if (!p) {
+                if (!(m = new0(MountPoint, 1))) {
                         r = -ENOMEM;
                         goto finish;
                 }
 
-                if (mount_point_is_api(p) || mount_point_ignore(p)) {
-                        free(p);
-                        continue;
-                }
-
-                if (!(m = new0(MountPoint, 1))) {
-                        free(p);
+                if (!(m->path = strdup(e->path))) {
+                        free(m);
                         r = -ENOMEM;
                         goto finish;
                 }
 
-                m->path = p;
-                m->skip_ro = skip_ro;
+                /* If we encounter a bind mount, don't try to remount
+                 * the source dir too early */
+                m->skip_ro = !streq(e->root, "/");
+
                 LIST_PREPEND(MountPoint, mount_point, *head, m);
+                points[e - t->entries] = m;
         }
 
+        /* Link every mount point to the one it is mounted on, so
+         * that we can unmount the tree bottom-up. Mount points whose
+         * parent we filtered out are treated as roots. */
+        MOUNT_TABLE_FOREACH(e, t) {
+                if (!(m = points[e - t->entries]) ||
+                    !e->parent ||
+                    !(p = points[e->parent - t->entries]))
+                        continue;
+
+                m->parent = p;
+                p->n_children++;
+        }
+
+        LIST_FOREACH(mount_point, m, *head)
+                for (p = m->parent; p; p = p->parent)
+                        m->depth++;
+
         r = 0;
 
 finish:
-        fclose(proc_self_mountinfo);
+        free(points);
+        mount_table_free(t);
 
         return r;
 }
@@ -338,7 +348,7 @@ static int dm_list_get(MountPoint **head) {
                         goto finish;
                 }
 
-                if (!(m = new(MountPoint, 1))) {
+                if (!(m = new0(MountPoint, 1))) {
                         free(node);
                         r = -ENOMEM;
                         goto finish;
@@ -363,32 +373,43 @@ finish:
 
 static int delete_loopback(const char *device) {
         int fd, r;
+        struct loop_info64 info;
 
         if ((fd = open(device, O_RDONLY|O_CLOEXEC)) < 0)
                 return errno == ENOENT ? 0 : -errno;
 
-        r = ioctl(fd, LOOP_CLR_FD, 0);
-        close_nointr_nofail(fd);
-
-        if (r >= 0)
+        if (ioctl(fd, LOOP_CLR_FD, 0) >= 0) {
+                close_nointr_nofail(fd);
                 return 1;
+        }
+
+        r = -errno;
+
+        /* Still in use, so let the kernel detach it as soon as the
+         * last user goes away */
+        if (r == -EBUSY &&
+            ioctl(fd, LOOP_GET_STATUS64, &info) >= 0) {
+
+                info.lo_flags |= LO_FLAGS_AUTOCLEAR;
+
+                if (ioctl(fd, LOOP_SET_STATUS64, &info) >= 0) {
+                        log_info("Loopback %s is busy, detaching lazily.", device);
+                        r = 0;
+                }
+        }
+
+        close_nointr_nofail(fd);
 
         /* ENXIO: not bound, so no error */
-        if (errno == ENXIO)
+        if (r == -ENXIO)
                 return 0;
 
-        return -errno;
+        return r;
 }
 
-static int delete_dm(dev_t devnum) {
-        int fd, r;
+static int dm_remove(int fd, dev_t devnum, uint32_t flags) {
         struct dm_ioctl dm;
 
-        assert(major(devnum) != 0);
-
-        if ((fd = open("/dev/mapper/control", O_RDWR|O_CLOEXEC)) < 0)
-                return -errno;
-
         zero(dm);
         dm.version[0] = DM_VERSION_MAJOR;
         dm.version[1] = DM_VERSION_MINOR;
@@ -396,40 +417,192 @@ static int delete_dm(dev_t devnum) {
 
         dm.data_size = sizeof(dm);
         dm.dev = devnum;
+        dm.flags = flags;
+
+        return ioctl(fd, DM_DEV_REMOVE, &dm) >= 0 ? 0 : -errno;
+}
+
+static int delete_dm(dev_t devnum) {
+        int fd, r;
+
+        assert(major(devnum) != 0);
+
+        if ((fd = open("/dev/mapper/control", O_RDWR|O_CLOEXEC)) < 0)
+                return -errno;
+
+        if ((r = dm_remove(fd, devnum, 0)) >= 0)
+                r = 1;
+
+#ifdef DM_DEFERRED_REMOVE
+        /* Still in use, so let the kernel remove it as soon as the
+         * last user goes away */
+        else if (r == -EBUSY &&
+                 dm_remove(fd, devnum, DM_DEFERRED_REMOVE) >= 0) {
+                log_info("DM device %u:%u is busy, removing lazily.", major(devnum), minor(devnum));
+                r = 0;
+        }
+#endif
 
-        r = ioctl(fd, DM_DEV_REMOVE, &dm);
         close_nointr_nofail(fd);
 
-        return r >= 0 ? 0 : -errno;
+        return r;
 }
 
-static int mount_points_list_umount(MountPoint **head, bool *changed) {
-        MountPoint *m, *n;
+static MountPoint *mount_points_list_next(MountPoint *head) {
+        MountPoint *m, *best = NULL;
+
+        /* Pick the deepest entry that is not running yet, did not
+         * fail and is not blocked by any of its children */
+
+        LIST_FOREACH(mount_point, m, head) {
+                if (m->worker > 0 || m->failed || m->n_children > 0)
+                        continue;
+
+                if (!best || m->depth > best->depth)
+                        best = m;
+        }
+
+        return best;
+}
+
+static void mount_points_list_complete(MountPoint **head, MountPoint *m, int r, bool *changed) {
+        assert(head);
+        assert(m);
+
+        m->worker = 0;
+
+        if (r < 0) {
+                /* This also blocks all our parents */
+                m->failed = true;
+                return;
+        }
+
+        if (r > 0 && changed)
+                *changed = true;
+
+        if (m->parent) {
+                assert(m->parent->n_children > 0);
+                m->parent->n_children--;
+        }
+
+        mount_point_free(head, m);
+}
+
+static int mount_points_list_run(MountPoint **head, int (*job)(MountPoint *m), bool *changed) {
+        MountPoint *m;
+        unsigned n_running = 0;
         int n_failed = 0;
 
         assert(head);
+        assert(job);
+
+        /* Runs job for every entry in a worker process of its own,
+         * with up to MOUNT_POINT_WORKERS_MAX of them at the same
+         * time, so that a hanging network file system or a slow
+         * device does not hold up everything else. The job returns
+         * > 0 if it changed something, 0 if it had nothing to do and
+         * < 0 on failure. All entries it succeeded on are removed
+         * from the list. */
+
+        for (;;) {
+                siginfo_t status;
+                int r;
 
-        LIST_FOREACH_SAFE(mount_point, m, n, *head) {
-                if (streq(m->path, "/")) {
-                        n_failed++;
-                        continue;
+                while (n_running < MOUNT_POINT_WORKERS_MAX &&
+                       (m = mount_points_list_next(*head))) {
+                        pid_t pid;
+
+                        if ((pid = fork()) < 0) {
+                                log_warning("Failed to fork worker, continuing synchronously: %m");
+                                mount_points_list_complete(head, m, job(m), changed);
+                                continue;
+                        }
+
+                        if (pid == 0) {
+                                /* Child */
+                                r = job(m);
+                                _exit(r < 0 ? EXIT_FAILURE : r > 0 ? EXIT_SUCCESS : MOUNT_POINT_EXIT_UNCHANGED);
+                        }
+
+                        m->worker = pid;
+                        n_running++;
                 }
 
-                /* Trying to umount. Forcing to umount if busy (only for NFS mounts) */
-                if (umount2(m->path, MNT_FORCE) == 0) {
-                        if (changed)
-                                *changed = true;
+                if (n_running <= 0)
+                        break;
 
-                        mount_point_free(head, m);
-                } else {
-                        log_warning("Could not unmount %s: %m", m->path);
-                        n_failed++;
+                zero(status);
+                if (waitid(P_ALL, 0, &status, WEXITED) < 0) {
+
+                        if (errno == EINTR)
+                                continue;
+
+                        log_error("waitid() failed: %m");
+
+                        LIST_FOREACH(mount_point, m, *head)
+                                if (m->worker > 0)
+                                        mount_points_list_complete(head, m, -ECHILD, changed);
+
+                        break;
                 }
+
+                /* We might have inherited some other processes, ignore
+                 * them */
+                LIST_FOREACH(mount_point, m, *head)
+                        if (m->worker == status.si_pid)
+                                break;
+
+                if (!m)
+                        continue;
+
+                if (status.si_code != CLD_EXITED)
+                        r = -EINTR;
+                else if (status.si_status == EXIT_SUCCESS)
+                        r = 1;
+                else if (status.si_status == MOUNT_POINT_EXIT_UNCHANGED)
+                        r = 0;
+                else
+                        r = -EIO;
+
+                mount_points_list_complete(head, m, r, changed);
+                n_running--;
         }
 
+        /* Whatever is left either failed or depends on something
+         * that failed */
+        LIST_FOREACH(mount_point, m, *head)
+                n_failed++;
+
         return n_failed;
 }
 
+static int mount_point_umount(MountPoint *m) {
+        int r;
+
+        assert(m);
+
+        /* Trying to umount. Forcing to umount if busy (only for NFS mounts) */
+        if (umount2(m->path, MNT_FORCE) < 0) {
+                r = -errno;
+                log_warning("Could not unmount %s: %s", m->path, strerror(-r));
+                return r;
+        }
+
+        return 1;
+}
+
+static int mount_points_list_umount(MountPoint **head, bool *changed) {
+        MountPoint *m;
+
+        assert(head);
+
+        LIST_FOREACH(mount_point, m, *head)
+                if (streq(m->path, "/"))
+                        m->failed = true;
+
+        return mount_points_list_run(head, mount_point_umount, changed);
+}
+
 static int mount_points_list_remount_read_only(MountPoint **head, bool *changed) {
         MountPoint *m, *n;
         int n_failed = 0;
@@ -479,74 +652,66 @@ static int swap_points_list_off(MountPoint **head, bool *changed) {
         return n_failed;
 }
 
+static int mount_point_delete_loopback(MountPoint *m) {
+        int r;
+
+        assert(m);
+
+        if ((r = delete_loopback(m->path)) < 0)
+                log_warning("Could not delete loopback %s: %s", m->path, strerror(-r));
+
+        return r;
+}
+
 static int loopback_points_list_detach(MountPoint **head, bool *changed) {
-        MountPoint *m, *n;
-        int n_failed = 0, k;
+        MountPoint *m;
+        int k;
         struct stat root_st;
 
         assert(head);
 
         k = lstat("/", &root_st);
 
-        LIST_FOREACH_SAFE(mount_point, m, n, *head) {
-                int r;
+        LIST_FOREACH(mount_point, m, *head) {
                 struct stat loopback_st;
 
                 if (k >= 0 &&
                     major(root_st.st_dev) != 0 &&
                     lstat(m->path, &loopback_st) >= 0 &&
-                    root_st.st_dev == loopback_st.st_rdev) {
-                        n_failed ++;
-                        continue;
-                }
+                    root_st.st_dev == loopback_st.st_rdev)
+                        m->failed = true;
+        }
 
-                if ((r = delete_loopback(m->path)) >= 0) {
+        return mount_points_list_run(head, mount_point_delete_loopback, changed);
+}
 
-                        if (r > 0 && changed)
-                                *changed = true;
+static int mount_point_delete_dm(MountPoint *m) {
+        int r;
 
-                        mount_point_free(head, m);
-                } else {
-                        log_warning("Could not delete loopback %s: %m", m->path);
-                        n_failed++;
-                }
-        }
+        assert(m);
 
-        return n_failed;
+        if ((r = delete_dm(m->devnum)) < 0)
+                log_warning("Could not delete dm %s: %s", m->path, strerror(-r));
+
+        return r;
 }
 
 static int dm_points_list_detach(MountPoint **head, bool *changed) {
-        MountPoint *m, *n;
-        int n_failed = 0, k;
+        MountPoint *m;
+        int k;
         struct stat root_st;
 
         assert(head);
 
         k = lstat("/", &root_st);
 
-        LIST_FOREACH_SAFE(mount_point, m, n, *head) {
-                int r;
-
+        LIST_FOREACH(mount_point, m, *head)
                 if (k >= 0 &&
                     major(root_st.st_dev) != 0 &&
-                    root_st.st_dev == m->devnum) {
-                        n_failed ++;
-                        continue;
-                }
+                    root_st.st_dev == m->devnum)
+                        m->failed = true;
 
-                if ((r = delete_dm(m->devnum)) >= 0) {
-
-                        if (r > 0 && changed)
-                                *changed = true;
-
-                        mount_point_free(head, m);
-                } else {
-                        log_warning("Could not delete dm %s: %m", m->path);
-                        n_failed++;
-                }
-        }
-
-        return n_failed;
+        return mount_points_list_run(head, mount_point_delete_dm, changed);
 }
 
 int umount_all(bool *changed) {
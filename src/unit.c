@@ -56,12 +56,13 @@ const UnitVTable * const unit_vtable[_UNIT_TYPE_MAX] = {
         [UNIT_PATH] = &path_vtable
 };
 
-Unit *unit_new(Manager *m) {
+Unit *unit_new(Manager *m, size_t size) {
         Unit *u;
 
         assert(m);
+        assert(size >= sizeof(Meta));
 
-        if (!(u = new0(Unit, 1)))
+        if (!(u = malloc0(size)))
                 return NULL;
 
         if (!(u->meta.names = set_new(string_hash_func, string_compare_func))) {
@@ -73,6 +74,7 @@ Unit *unit_new(Manager *m) {
         u->meta.type = _UNIT_TYPE_INVALID;
         u->meta.deserialized_job = _JOB_TYPE_INVALID;
         u->meta.default_dependencies = true;
+        cgroup_accounting_reset(&u->meta.cgroup_accounting);
 
         return u;
 }
@@ -1748,17 +1750,9 @@ int unit_add_cgroup(Unit *u, CGroupBonding *b) {
         /* Ensure this hasn't been added yet */
         assert(!b->unit);
 
-        if (streq(b->controller, SYSTEMD_CGROUP_CONTROLLER)) {
-                CGroupBonding *l;
-
-                l = hashmap_get(u->meta.manager->cgroup_bondings, b->path);
-                LIST_PREPEND(CGroupBonding, by_path, l, b);
-
-                if ((r = hashmap_replace(u->meta.manager->cgroup_bondings, b->path, l)) < 0) {
-                        LIST_REMOVE(CGroupBonding, by_path, l, b);
+        if (streq(b->controller, SYSTEMD_CGROUP_CONTROLLER))
+                if ((r = cgroup_node_add_bonding(u->meta.manager, b)) < 0)
                         return r;
-                }
-        }
 
         LIST_PREPEND(CGroupBonding, by_unit, u->meta.cgroup_bondings, b);
         b->unit = u;
@@ -2020,54 +2014,70 @@ char *unit_name_printf(Unit *u, const char* format) {
         return specifier_printf(format, table, u);
 }
 
+static char *specifier_id(char specifier, void *data, void *userdata) {
+        Unit *u = userdata;
+        assert(u);
+
+        return strdup(u->meta.id);
+}
+
+static char *specifier_instance(char specifier, void *data, void *userdata) {
+        Unit *u = userdata;
+        assert(u);
+
+        return strdup(strempty(u->meta.instance));
+}
+
+/* Shared by unit_full_printf() and unit_full_printf_template(). All
+ * entries take the unit from userdata, hence this can be static. */
+static const Specifier full_printf_table[] = {
+        { 'n', specifier_id,                  NULL },
+        { 'N', specifier_prefix_and_instance, NULL },
+        { 'p', specifier_prefix,              NULL },
+        { 'P', specifier_prefix_unescaped,    NULL },
+        { 'i', specifier_instance,            NULL },
+        { 'I', specifier_instance_unescaped,  NULL },
+        { 'f', specifier_filename,            NULL },
+        { 0, NULL, NULL }
+};
+
 char *unit_full_printf(Unit *u, const char *format) {
 
         /* This is similar to unit_name_printf() but also supports
          * unescaping */
 
-        const Specifier table[] = {
-                { 'n', specifier_string,              u->meta.id },
-                { 'N', specifier_prefix_and_instance, NULL },
-                { 'p', specifier_prefix,              NULL },
-                { 'P', specifier_prefix_unescaped,    NULL },
-                { 'i', specifier_string,              u->meta.instance },
-                { 'I', specifier_instance_unescaped,  NULL },
-                { 'f', specifier_filename,            NULL },
-                { 0, NULL, NULL }
-        };
-
         assert(u);
         assert(format);
 
-        return specifier_printf(format, table, u);
+        return specifier_printf(format, full_printf_table, u);
+}
+
+char **unit_full_printf_template(Unit *u, const SpecifierTemplate *t) {
+
+        /* Like unit_full_printf_strv(), but operates on a command
+         * line that has been compiled at load time */
+
+        assert(u);
+        assert(t);
+
+        return specifier_template_expand_strv(t, full_printf_table, u);
 }
 
 char **unit_full_printf_strv(Unit *u, char **l) {
-        size_t n;
-        char **r, **i, **j;
+        SpecifierTemplate *t;
+        char **r;
 
         /* Applies unit_full_printf to every entry in l */
 
         assert(u);
 
-        n = strv_length(l);
-        if (!(r = new(char*, n+1)))
+        if (!(t = specifier_template_new_strv(l)))
                 return NULL;
 
-        for (i = l, j = r; *i; i++, j++)
-                if (!(*j = unit_full_printf(u, *i)))
-                        goto fail;
+        r = unit_full_printf_template(u, t);
+        specifier_template_free(t);
 
-        *j = NULL;
         return r;
-
-fail:
-        for (j--; j >= r; j--)
-                free(*j);
-
-        free(r);
-
-        return NULL;
 }
 
 int unit_watch_bus_name(Unit *u, const char *name) {
@@ -2408,14 +2418,16 @@ int unit_kill(Unit *u, KillWho w, KillMode m, int signo, DBusError *error) {
 }
 
 
-int unit_following_set(Unit *u, Set **s) {
+int unit_following_set(Unit *u, Unit ***units, unsigned *n) {
         assert(u);
-        assert(s);
+        assert(units);
+        assert(n);
 
         if (UNIT_VTABLE(u)->following_set)
-                return UNIT_VTABLE(u)->following_set(u, s);
+                return UNIT_VTABLE(u)->following_set(u, units, n);
 
-        *s = NULL;
+        *units = NULL;
+        *n = 0;
         return 0;
 }
 
@@ -167,6 +167,9 @@ struct Meta {
         /* Counterparts in the cgroup filesystem */
         CGroupBonding *cgroup_bondings;
 
+        /* Last resource usage sample of the above */
+        CGroupAccounting cgroup_accounting;
+
         /* Per type list */
         LIST_FIELDS(Meta, units_per_type);
 
@@ -259,6 +262,12 @@ union Unit {
 struct UnitVTable {
         const char *suffix;
 
+        /* How much memory to allocate for a unit of this type. We
+         * don't allocate the full Unit union, since most units, for
+         * example all the devices, are much smaller than the largest
+         * type. */
+        size_t object_size;
+
         /* This should reset all type-specific variables. This should
          * not allocate memory, and is called with zero-initialized
          * data. It should hence only initialize variables that need
@@ -340,8 +349,10 @@ struct UnitVTable {
         /* Return the unit this unit is following */
         Unit *(*following)(Unit *u);
 
-        /* Return the set of units that are following each other */
-        int (*following_set)(Unit *u, Set **s);
+        /* Return all units that are following each other, including
+         * this one. The array is owned by the unit type and must not
+         * be modified. */
+        int (*following_set)(Unit *u, Unit ***units, unsigned *n);
 
         /* This is called for each unit type and should be used to
          * enumerate existing devices and load them. However,
@@ -401,7 +412,7 @@ DEFINE_CAST(SNAPSHOT, Snapshot);
 DEFINE_CAST(SWAP, Swap);
 DEFINE_CAST(PATH, Path);
 
-Unit *unit_new(Manager *m);
+Unit *unit_new(Manager *m, size_t size);
 void unit_free(Unit *u);
 
 int unit_add_name(Unit *u, const char *name);
@@ -487,6 +498,7 @@ int unit_get_related_unit(Unit *u, const char *type, Unit **_found);
 char *unit_name_printf(Unit *u, const char* text);
 char *unit_full_printf(Unit *u, const char *text);
 char **unit_full_printf_strv(Unit *u, char **l);
+char **unit_full_printf_template(Unit *u, const SpecifierTemplate *t);
 
 bool unit_can_serialize(Unit *u);
 int unit_serialize(Unit *u, FILE *f, FDSet *fds);
@@ -511,7 +523,7 @@ bool unit_pending_active(Unit *u);
 
 int unit_add_default_target_dependency(Unit *u, Unit *target);
 
-int unit_following_set(Unit *u, Set **s);
+int unit_following_set(Unit *u, Unit ***units, unsigned *n);
 
 UnitType unit_name_to_type(const char *n);
 bool unit_name_is_valid(const char *n, bool template_ok);
@@ -451,10 +451,10 @@ char **split_path_and_make_absolute(const char *p) {
 }
 
 int get_parent_of_pid(pid_t pid, pid_t *_ppid) {
-        int r;
-        FILE *f;
-        char fn[PATH_MAX], line[LINE_MAX], *p;
-        long unsigned ppid;
+        char fn[64], line[128], *p, *e;
+        unsigned long ppid;
+        ssize_t n;
+        int fd;
 
         assert(pid > 0);
         assert(_ppid);
@@ -462,33 +462,43 @@ int get_parent_of_pid(pid_t pid, pid_t *_ppid) {
         assert_se(snprintf(fn, sizeof(fn)-1, "/proc/%lu/stat", (unsigned long) pid) < (int) (sizeof(fn)-1));
         char_array_0(fn);
 
-        if (!(f = fopen(fn, "r")))
+        if ((fd = open(fn, O_RDONLY|O_CLOEXEC|O_NOCTTY)) < 0)
                 return -errno;
 
-        if (!(fgets(line, sizeof(line), f))) {
-                r = -errno;
-                fclose(f);
-                return r;
-        }
+        /* The comm field is at most 16 chars, so the ppid is always
+         * within the first few dozen bytes, and one read is enough */
+        n = read(fd, line, sizeof(line)-1);
+        close_nointr_nofail(fd);
 
-        fclose(f);
+        if (n < 0)
+                return -errno;
+
+        line[n] = 0;
 
         /* Let's skip the pid and comm fields. The latter is enclosed
          * in () but does not escape any () in its value, so let's
-         * skip over it manually */
+         * skip over it manually. None of the fields following it
+         * contain a ')'. */
 
         if (!(p = strrchr(line, ')')))
                 return -EIO;
 
         p++;
 
-        if (sscanf(p, " "
-                   "%*c "  /* state */
-                   "%lu ", /* ppid */
-                   &ppid) != 1)
+        /* Skip the state field */
+        p += strspn(p, WHITESPACE);
+        if (!*p)
+                return -EIO;
+        p++;
+
+        p += strspn(p, WHITESPACE);
+
+        errno = 0;
+        ppid = strtoul(p, &e, 10);
+        if (errno != 0 || e == p || !strchr(WHITESPACE, *e) || *e == 0)
                 return -EIO;
 
-        if ((long unsigned) (pid_t) ppid != ppid)
+        if ((unsigned long) (pid_t) ppid != ppid)
                 return -ERANGE;
 
         *_ppid = (pid_t) ppid;
@@ -884,51 +894,65 @@ int get_process_name(pid_t pid, char **name) {
 }
 
 int get_process_cmdline(pid_t pid, size_t max_length, char **line) {
-        char *p, *r, *k;
-        int c;
+        char fn[64], buf[4096], *r, *k;
         bool space = false;
         size_t left;
-        FILE *f;
+        int fd;
 
         assert(pid >= 1);
         assert(max_length > 0);
         assert(line);
 
-        if (asprintf(&p, "/proc/%lu/cmdline", (unsigned long) pid) < 0)
-                return -ENOMEM;
-
-        f = fopen(p, "r");
-        free(p);
+        snprintf(fn, sizeof(fn), "/proc/%lu/cmdline", (unsigned long) pid);
+        char_array_0(fn);
 
-        if (!f)
+        if ((fd = open(fn, O_RDONLY|O_CLOEXEC|O_NOCTTY)) < 0)
                 return -errno;
 
         if (!(r = new(char, max_length))) {
-                fclose(f);
+                close_nointr_nofail(fd);
                 return -ENOMEM;
         }
 
+        /* Read in chunks rather than char-by-char through stdio,
+         * since this is called for every process by systemd-cgls */
+
         k = r;
         left = max_length;
-        while ((c = getc(f)) != EOF) {
+        while (left > 4) {
+                ssize_t n;
+                char *p;
+
+                if ((n = read(fd, buf, sizeof(buf))) < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        break;
+                }
+
+                if (n == 0)
+                        break;
+
+                for (p = buf; p < buf + n; p++) {
+
+                        if (isprint((unsigned char) *p)) {
+                                if (space) {
+                                        if (left <= 4)
+                                                break;
+
+                                        *(k++) = ' ';
+                                        left--;
+                                        space = false;
+                                }
 
-                if (isprint(c)) {
-                        if (space) {
                                 if (left <= 4)
                                         break;
 
-                                *(k++) = ' ';
+                                *(k++) = *p;
                                 left--;
-                                space = false;
-                        }
-
-                        if (left <= 4)
-                                break;
-
-                        *(k++) = (char) c;
-                        left--;
-                }  else
-                        space = true;
+                        } else
+                                space = true;
+                }
         }
 
         if (left <= 4) {
@@ -938,7 +962,7 @@ int get_process_cmdline(pid_t pid, size_t max_length, char **line) {
         } else
                 *k = 0;
 
-        fclose(f);
+        close_nointr_nofail(fd);
 
         /* Kernel threads have no argv[] */
         if (r[0] == 0) {
@@ -1827,6 +1851,17 @@ bool path_startswith(const char *path, const char *prefix) {
         }
 }
 
+size_t path_next_component(const char **p) {
+        assert(p);
+        assert(*p);
+
+        /* Returns the length of the next path component, and makes
+         * *p point to its beginning */
+
+        *p += strspn(*p, "/");
+        return strcspn(*p, "/");
+}
+
 bool path_equal(const char *a, const char *b) {
         assert(a);
         assert(b);
@@ -264,6 +264,7 @@ char *bus_path_unescape(const char *s);
 char *path_kill_slashes(char *path);
 
 bool path_startswith(const char *path, const char *prefix);
+size_t path_next_component(const char **p);
 bool path_equal(const char *a, const char *b);
 
 char *ascii_strlower(char *path);